@@ -0,0 +1,111 @@
+#!/bin/sh
+# Compare u-config with other pkg-config implementations
+#   $ bench/compare.sh [-n RUNS] [-m MAX] CORPUS|host UCONFIG [OTHER...]
+#
+# Runs identical queries through UCONFIG and each OTHER binary, by default
+# whichever of pkgconf and pkg-config are on PATH. CORPUS is a directory
+# written by bench/corpus.c, or "host" to query up to MAX (default 50)
+# packages from UCONFIG's own default search path. Reports latency
+# percentiles and peak RSS over RUNS runs (via bench/latency.c), syscall
+# counts when strace is installed, and whether each output and exit
+# status matches UCONFIG's, so that every speed comparison is also a
+# correctness check. Trailing white space is ignored, since pkgconf
+# always leaves some. Output differences are kept in the work directory.
+#
+# This is free and unencumbered software released into the public domain.
+set -e
+
+runs=20
+max=50
+while getopts n:m: opt; do
+    case $opt in
+        n) runs=$OPTARG;;
+        m) max=$OPTARG;;
+        *) exit 1;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ $# -lt 2 ]; then
+    echo "usage: $0 [-n RUNS] [-m MAX] CORPUS|host UCONFIG [OTHER...]" >&2
+    exit 1
+fi
+corpus=$1
+uconfig=$2
+shift 2
+
+here=$(dirname "$0")
+work=$(mktemp -d "${TMPDIR:-/tmp}/compare.XXXXXX")
+
+if [ $# -eq 0 ]; then
+    self=$(readlink -f "$(command -v "$uconfig")")
+    seen=$self
+    for name in pkgconf pkg-config; do
+        bin=$(command -v $name) || continue
+        real=$(readlink -f "$bin")
+        case " $seen " in *" $real "*) continue;; esac
+        seen="$seen $real"
+        set -- "$@" "$bin"
+    done
+fi
+
+if [ "$corpus" = host ]; then
+    corpus=$work
+    "$uconfig" --variable pc_path pkg-config >"$corpus/path"
+    tr : '\n' <"$corpus/path" | while read -r dir; do
+        ls "$dir" 2>/dev/null | sed -n 's/\.pc$//p'
+    done | sort -u | head -n "$max" | while read -r name; do
+        printf '%s\t--cflags --libs %s\n' "$name" "$name"
+    done >"$corpus/queries"
+fi
+
+latency=${LATENCY:-$here/latency}
+if [ ! -x "$latency" ]; then
+    latency=$work/latency
+    ${CC:-cc} -O2 -o "$latency" "$here/latency.c"
+fi
+
+echo "work directory: $work"
+"$latency" -n "$runs" "$corpus" "$uconfig" "$@"
+
+PKG_CONFIG_LIBDIR=$(cat "$corpus/path")
+export PKG_CONFIG_LIBDIR
+unset PKG_CONFIG_PATH
+strace=$(command -v strace || :)
+
+set -f  # query arguments are split on spaces, but never globbed
+echo
+printf '%-20s %-32s %9s  %s\n' query binary syscalls output
+differ=0
+while IFS='	' read -r name args; do
+    i=0
+    for bin in "$uconfig" "$@"; do
+        out=$work/$name.$i.out
+        status=0
+        "$bin" $args 2>/dev/null </dev/null >"$work/raw" || status=$?
+        sed 's/[[:space:]]*$//' "$work/raw" >"$out"
+        echo "exit status $status" >>"$out"
+
+        calls=-
+        if [ -n "$strace" ]; then
+            "$strace" -f -c -o "$work/strace" "$bin" $args \
+                >/dev/null 2>&1 </dev/null || :
+            calls=$(awk '$NF == "total" { print $4 }' "$work/strace")
+        fi
+
+        result=reference
+        if [ $i -gt 0 ]; then
+            if cmp -s "$work/$name.0.out" "$out"; then
+                result=same
+            else
+                result="DIFFERS, see $name.$i.diff"
+                diff "$work/$name.0.out" "$out" >"$work/$name.$i.diff" || :
+                differ=$((differ + 1))
+            fi
+        fi
+        printf '%-20s %-32s %9s  %s\n' "$name" "$bin" "$calls" "$result"
+        i=$((i + 1))
+    done
+done <"$corpus/queries"
+
+echo
+echo "$differ differing outputs"
@@ -0,0 +1,245 @@
+// Synthetic .pc corpus generator for end-to-end benchmarks
+//   $ cc -o corpus bench/corpus.c
+//   $ ./corpus [-d DEPTH] [-w WIDTH] [-D DIRS] [-v VARS] [-l LIBS] OUTDIR
+//
+// Writes a package tree under OUTDIR shaped to stress particular costs:
+//
+//   chain0..     a Requires chain DEPTH long, with version constraints
+//   fan          requires WIDTH packages that all require "base"
+//   diamond      layers of four packages, each requiring the whole next
+//                layer, so the closure is small but the edges many
+//   private      Requires.private on WIDTH packages, each with LIBS
+//                entries in Libs.private
+//   vars         VARS variables, each defined in terms of an earlier one,
+//                as a binary tree so that nesting stays shallow
+//
+// The packages live in the last of DIRS search directories, and the
+// others hold only unrelated packages, so that nearly every lookup is a
+// miss before a hit. Two more files describe how to query the corpus:
+// OUTDIR/path holds the search path for PKG_CONFIG_LIBDIR, and
+// OUTDIR/queries lists one query per line, its name, a tab, and its
+// arguments separated by spaces. The output depends only on the options.
+//
+// This is free and unencumbered software released into the public domain.
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char *outdir;
+static char  pkgdir[4096];
+
+static void fatal(char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fputs("corpus: ", stderr);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+    exit(1);
+}
+
+static void makedir(char *path)
+{
+    if (mkdir(path, 0777) && errno!=EEXIST) {
+        fatal("could not create %s", path);
+    }
+}
+
+static FILE *create(char *dir, char *name)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fatal("could not create %s", path);
+    }
+    return f;
+}
+
+static void done(FILE *f)
+{
+    if (fflush(f) || ferror(f) || fclose(f)) {
+        fatal("write error");
+    }
+}
+
+// Open a package file in the package directory and write its header.
+static FILE *package(char *name, char *version)
+{
+    char file[256];
+    snprintf(file, sizeof(file), "%s.pc", name);
+    FILE *f = create(pkgdir, file);
+    fprintf(f,
+        "prefix=/opt/%s\n"
+        "exec_prefix=${prefix}\n"
+        "libdir=${exec_prefix}/lib\n"
+        "includedir=${prefix}/include\n"
+        "\n"
+        "Name: %s\n"
+        "Description: Synthetic %s package\n"
+        "Version: %s\n",
+        name, name, name, version
+    );
+    return f;
+}
+
+static void flags(FILE *f, char *name)
+{
+    fprintf(f,
+        "Cflags: -I${includedir}/%s -I${includedir} -D%s_SHARED\n"
+        "Libs: -L${libdir} -l%s\n",
+        name, name, name
+    );
+}
+
+int main(int argc, char **argv)
+{
+    int depth = 40;
+    int width = 16;
+    int ndirs = 300;
+    int nvars = 200;
+    int nlibs = 40;
+
+    for (int opt; (opt = getopt(argc, argv, "d:w:D:v:l:")) != -1;) {
+        switch (opt) {
+        case 'd': depth = atoi(optarg); break;
+        case 'w': width = atoi(optarg); break;
+        case 'D': ndirs = atoi(optarg); break;
+        case 'v': nvars = atoi(optarg); break;
+        case 'l': nlibs = atoi(optarg); break;
+        default : return 1;
+        }
+    }
+    if (optind != argc-1 || depth<1 || width<1 || ndirs<1 || nvars<1) {
+        fputs("usage: corpus [-d DEPTH] [-w WIDTH] [-D DIRS] [-v VARS] "
+              "[-l LIBS] OUTDIR\n", stderr);
+        return 1;
+    }
+    outdir = argv[optind];
+    makedir(outdir);
+
+    // Search directories, all but the last holding only noise
+    FILE *path = create(outdir, "path");
+    for (int d = 0; d < ndirs; d++) {
+        char dir[4096];
+        snprintf(dir, sizeof(dir), "%s/d%03d", outdir, d);
+        makedir(dir);
+        fprintf(path, "%s%s", d ? ":" : "", dir);
+        if (d == ndirs-1) {
+            memcpy(pkgdir, dir, sizeof(dir));
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            char name[64];
+            snprintf(name, sizeof(name), "noise%d_%d.pc", d, i);
+            FILE *f = create(dir, name);
+            fprintf(f, "Name: noise\nDescription: noise\nVersion: 0\n");
+            done(f);
+        }
+    }
+    fputc('\n', path);
+    done(path);
+
+    FILE *f = package("base", "1.0");
+    flags(f, "base");
+    done(f);
+
+    for (int i = 0; i < depth; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "chain%d", i);
+        f = package(name, "2.4.1");
+        if (i+1 < depth) {
+            fprintf(f, "Requires: chain%d >= 2.0, base\n", i+1);
+        }
+        flags(f, name);
+        done(f);
+    }
+
+    f = package("fan", "1.0");
+    fprintf(f, "Requires:");
+    for (int i = 0; i < width; i++) {
+        fprintf(f, " fan%d", i);
+    }
+    fprintf(f, "\n");
+    flags(f, "fan");
+    done(f);
+    for (int i = 0; i < width; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "fan%d", i);
+        f = package(name, "1.0");
+        fprintf(f, "Requires: base\n");
+        flags(f, name);
+        done(f);
+    }
+
+    int layers = 8;
+    f = package("diamond", "1.0");
+    fprintf(f, "Requires: dia0_0 dia0_1 dia0_2 dia0_3\n");
+    flags(f, "diamond");
+    done(f);
+    for (int l = 0; l < layers; l++) {
+        for (int i = 0; i < 4; i++) {
+            char name[64];
+            snprintf(name, sizeof(name), "dia%d_%d", l, i);
+            f = package(name, "1.0");
+            if (l+1 < layers) {
+                fprintf(f, "Requires: dia%d_0 dia%d_1 dia%d_2 dia%d_3\n",
+                        l+1, l+1, l+1, l+1);
+            }
+            flags(f, name);
+            done(f);
+        }
+    }
+
+    f = package("private", "1.0");
+    fprintf(f, "Requires.private:");
+    for (int i = 0; i < width; i++) {
+        fprintf(f, " priv%d", i);
+    }
+    fprintf(f, "\n");
+    flags(f, "private");
+    done(f);
+    for (int i = 0; i < width; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "priv%d", i);
+        f = package(name, "1.0");
+        flags(f, name);
+        fprintf(f, "Libs.private:");
+        for (int j = 0; j < nlibs; j++) {
+            fprintf(f, " -lp%d_%d", i, j);
+        }
+        fprintf(f, " -lm -lpthread\n");
+        done(f);
+    }
+
+    f = package("vars", "1.0");
+    fprintf(f, "v0=${prefix}\n");
+    for (int i = 1; i < nvars; i++) {
+        fprintf(f, "v%d=${v%d}/%d\n", i, (i-1)/2, i);
+    }
+    fprintf(f, "Cflags:");
+    for (int i = nvars/2; i < nvars; i += 8) {
+        fprintf(f, " -I${v%d}", i);
+    }
+    fprintf(f, "\n");
+    fprintf(f, "Libs: -L${libdir} -lvars\n");
+    done(f);
+
+    FILE *q = create(outdir, "queries");
+    fprintf(q, "version\t--version\n");
+    fprintf(q, "miss\t--exists nonexistent\n");
+    fprintf(q, "modversion\t--modversion chain%d\n", depth-1);
+    fprintf(q, "chain\t--cflags --libs chain0\n");
+    fprintf(q, "fan\t--cflags --libs fan\n");
+    fprintf(q, "diamond\t--cflags --libs diamond\n");
+    fprintf(q, "private\t--static --libs private\n");
+    fprintf(q, "vars\t--cflags vars\n");
+    fprintf(q, "list-all\t--list-all\n");
+    done(q);
+    return 0;
+}
@@ -0,0 +1,155 @@
+// End-to-end latency of pkg-config implementations over a corpus
+//   $ cc -O2 -o latency bench/latency.c
+//   $ ./latency [-n RUNS] CORPUS BINARY...
+//
+// Runs every query listed in CORPUS/queries (see bench/corpus.c) RUNS
+// times through each BINARY, with PKG_CONFIG_LIBDIR set to the corpus
+// search path and output discarded, and reports percentiles of
+// the wall time from spawn to exit, in microseconds, and the largest
+// peak resident set size, in KiB. Queries that exit unsuccessfully are
+// flagged, which is expected only of "miss".
+//
+// This is free and unencumbered software released into the public domain.
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static long long micros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+static char *slurp(char *dir, char *name)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "latency: could not read %s\n", path);
+        exit(1);
+    }
+    static char buf[1<<20];
+    size_t len = fread(buf, 1, sizeof(buf)-1, f);
+    fclose(f);
+    buf[len] = 0;
+    return strdup(buf);
+}
+
+// Run once, returning elapsed microseconds, negative on failure, and
+// raising the peak RSS to the child's if larger.
+static long long run(char **argv, posix_spawn_file_actions_t *fa, long *rss)
+{
+    long long beg = micros();
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], fa, 0, argv, environ)) {
+        return -1;
+    }
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        return -1;
+    }
+    long long end = micros();
+    *rss = ru.ru_maxrss>*rss ? ru.ru_maxrss : *rss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        return -(end - beg) - 1;
+    }
+    return end - beg;
+}
+
+static int compare(const void *a, const void *b)
+{
+    long long x = *(long long *)a;
+    long long y = *(long long *)b;
+    return (x > y) - (x < y);
+}
+
+static long long percentile(long long *times, int n, int p)
+{
+    int i = (n*p + 99)/100 - 1;
+    return times[i<0 ? 0 : i];
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 50;
+    for (int opt; (opt = getopt(argc, argv, "n:")) != -1;) {
+        switch (opt) {
+        case 'n': runs = atoi(optarg); break;
+        default : return 1;
+        }
+    }
+    if (argc-optind<2 || runs<1) {
+        fputs("usage: latency [-n RUNS] CORPUS BINARY...\n", stderr);
+        return 1;
+    }
+    char *corpus = argv[optind++];
+
+    char *path = slurp(corpus, "path");
+    path[strcspn(path, "\n")] = 0;
+    setenv("PKG_CONFIG_LIBDIR", path, 1);
+    unsetenv("PKG_CONFIG_PATH");
+    char *queries = slurp(corpus, "queries");
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, 2, "/dev/null", O_WRONLY, 0);
+
+    long long *times = calloc((size_t)runs, sizeof(*times));
+    for (int b = optind; b < argc; b++) {
+        printf("%s\n", argv[b]);
+        printf("  %-12s %8s %8s %8s %8s %8s\n",
+               "query", "p50 us", "p90 us", "p99 us", "max us", "rss KiB");
+
+        char *line = queries;
+        for (char *next; *line; line = next) {
+            next = line + strcspn(line, "\n");
+            next += !!*next;
+
+            char copy[1024];
+            size_t len = (size_t)(next - line);
+            len = len<sizeof(copy) ? len : sizeof(copy)-1;
+            memcpy(copy, line, len);
+            copy[len] = 0;
+
+            char *args[64] = {argv[b]};
+            int nargs = 1;
+            char *name = strtok(copy, "\t\n");
+            for (char *a; nargs<63 && (a = strtok(0, " \n"));) {
+                args[nargs++] = a;
+            }
+            if (!name) {
+                continue;
+            }
+
+            int failed = 0;
+            long rss = 0;
+            run(args, &fa, &rss);  // warm the page cache
+            for (int i = 0; i < runs; i++) {
+                times[i] = run(args, &fa, &rss);
+                if (times[i] < 0) {
+                    failed = 1;
+                    times[i] = -times[i] - 1;
+                }
+            }
+            qsort(times, (size_t)runs, sizeof(*times), compare);
+            printf("  %-12s %8lld %8lld %8lld %8lld %8ld%s\n", name,
+                   percentile(times, runs, 50), percentile(times, runs, 90),
+                   percentile(times, runs, 99), times[runs-1], rss,
+                   failed ? "  nonzero exit" : "");
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
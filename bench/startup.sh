@@ -0,0 +1,108 @@
+#!/bin/sh
+# Startup latency and page faults across u-config platform layers
+#   $ bench/startup.sh [-n RUNS] [-o HISTORY] LABEL=BINARY...
+#
+# For each BINARY, measures exec-to-exit time and page faults (via
+# bench/startup.c) of --version, --modversion, and --libs on a single
+# small package. A BINARY ending in .wasm runs under wasmtime or wasmer
+# when either is installed, and is otherwise skipped, and its numbers
+# include the runtime's own startup. Every result is appended to HISTORY
+# (default bench/startup-history.tsv) along with the date, commit, and
+# binary size, and is shown next to the previous result for the same
+# label and query, so that regressions in size or startup stand out.
+#
+# This is free and unencumbered software released into the public domain.
+set -e
+
+runs=200
+here=$(dirname "$0")
+history=$here/startup-history.tsv
+while getopts n:o: opt; do
+    case $opt in
+        n) runs=$OPTARG;;
+        o) history=$OPTARG;;
+        *) exit 1;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ $# -eq 0 ]; then
+    echo "usage: $0 [-n RUNS] [-o HISTORY] LABEL=BINARY..." >&2
+    exit 1
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/startup.XXXXXX")
+trap 'rm -rf "$work"' EXIT
+
+startup=${STARTUP:-$here/startup}
+if [ ! -x "$startup" ]; then
+    startup=$work/startup
+    ${CC:-cc} -O2 -o "$startup" "$here/startup.c"
+fi
+
+mkdir "$work/pc"
+cat >"$work/pc/startup.pc" <<EOF
+prefix=/usr
+libdir=\${prefix}/lib
+
+Name: startup
+Description: Startup benchmark package
+Version: 1.0
+Libs: -L\${libdir} -lstartup
+EOF
+PKG_CONFIG_LIBDIR=$work/pc
+export PKG_CONFIG_LIBDIR
+unset PKG_CONFIG_PATH
+
+wasmrun=
+if command -v wasmtime >/dev/null; then
+    wasmrun="wasmtime run --dir=$work/pc --env PKG_CONFIG_LIBDIR=$work/pc"
+elif command -v wasmer >/dev/null; then
+    wasmrun="wasmer run --dir=$work/pc --env PKG_CONFIG_LIBDIR=$work/pc"
+fi
+
+date=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+commit=$(git -C "$here" describe --always --dirty 2>/dev/null || echo -)
+[ -f "$history" ] || touch "$history"
+
+set -f  # command words are split, but never globbed
+printf '%-14s %-12s %8s %8s %8s %7s %7s %9s %7s\n' \
+    label query bytes 'p50 us' 'p90 us' minflt majflt 'prev p50' change
+for pair in "$@"; do
+    label=${pair%%=*}
+    binary=${pair#*=}
+    size=$(wc -c <"$binary" | tr -d ' ')
+
+    prefix=
+    case $binary in
+        *.wasm)
+            if [ -z "$wasmrun" ]; then
+                echo "$label: no wasmtime or wasmer, skipped"
+                continue
+            fi
+            prefix=$wasmrun
+            [ "${wasmrun%% *}" = wasmer ] && binary="$binary --"
+            ;;
+    esac
+
+    for query in version modversion libs; do
+        case $query in
+            version)    args=--version;;
+            modversion) args='--modversion startup';;
+            libs)       args='--libs startup';;
+        esac
+        read -r p50 p90 minflt majflt <<EOF
+$("$startup" -n "$runs" $prefix $binary $args)
+EOF
+
+        prev=$(awk -F '\t' -v l="$label" -v q="$query" \
+               '$3 == l && $4 == q { p = $6 } END { print p }' "$history")
+        change=$(awk -v p="$prev" -v n="$p50" \
+                 'BEGIN { if (p > 0) printf "%+.0f%%", 100*(n - p)/p }')
+        printf '%-14s %-12s %8s %8s %8s %7s %7s %9s %7s\n' "$label" \
+            "$query" "$size" "$p50" "$p90" "$minflt" "$majflt" \
+            "${prev:--}" "${change:--}"
+        printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' "$date" "$commit" \
+            "$label" "$query" "$size" "$p50" "$p90" "$minflt" "$majflt" \
+            >>"$history"
+    done
+done
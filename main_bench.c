@@ -0,0 +1,417 @@
+// Microbenchmarks for u-config
+// Times hot paths and whole runs over synthetic inputs held in an
+// in-memory filesystem, as in the test suite, so that results measure
+// u-config itself rather than the operating system. Each benchmark runs
+// for at least a quarter second and reports nanoseconds per operation.
+// An optional argument selects benchmarks by name prefix.
+//   $ cc -O2 -o benchmarks main_bench.c
+//   $ ./benchmarks [PREFIX]
+// This is free and unencumbered software released into the public domain.
+#include "src/u-config.c"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct os {
+    jmp_buf exit;
+    env    *filesystem;
+    u32     sink;  // consumes results so they are not optimized out
+};
+
+static i64 nanos_(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*(i64)1000000000 + ts.tv_nsec;
+}
+
+static void os_fail(os *ctx)
+{
+    longjmp(ctx->exit, 1);
+}
+
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    return nanos_() / 1000;
+}
+
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    (void)ctx;
+    (void)scratch;
+    (void)path;
+    (void)data;
+    (void)header;
+}
+
+static filemap os_mapfile(os *ctx, arena *perm, s8 path)
+{
+    (void)perm;
+    assert(path.s);
+    assert(path.len);
+    assert(!path.s[path.len-1]);
+    path.len--;  // trim null terminator
+
+    filemap r = {0};
+    s8 *data = insert(&ctx->filesystem, path, 0, 0);
+    if (!data) {
+        r.status = filemap_NOTFOUND;
+        return r;
+    }
+    r.data = *data;
+    r.status = filemap_OK;
+    return r;
+}
+
+static s8node *os_listing(os *ctx, arena *a, s8 path)
+{
+    assert(path.s);
+    assert(path.len);
+    assert(!path.s[path.len-1]);
+    path = cuttail(path, 1);
+    s8list r = {0};
+    env *fs = ctx->filesystem;
+    for (i32 i = 0; fs && i<fs->len; i++) {
+        s8 name = fs->vars[i].name;
+        if (startswith(name, path)) {
+            append(&r, cuthead(name, path.len+1), a);
+        }
+    }
+    return r.head;
+}
+
+static void os_write(os *ctx, i32 fd, s8 s)
+{
+    (void)fd;
+    ctx->sink += (u32)s.len;
+}
+
+// Benchmark loop state: batches double until the minimum time elapses.
+typedef struct {
+    char *name;
+    i64   beg;
+    i64   iters;
+    i64   batch;
+    i64   done;
+    b32   skip;
+} bench;
+
+static char *filter_ = "";
+
+static bench newbench_(char *name)
+{
+    bench b = {0};
+    b.name = name;
+    b.batch = 1;
+    for (char *f = filter_, *n = name; *f; f++, n++) {
+        if (*f != *n) {
+            b.skip = 1;
+            break;
+        }
+    }
+    b.beg = nanos_();
+    return b;
+}
+
+static b32 running_(bench *b)
+{
+    if (b->skip) {
+        return 0;
+    }
+    if (b->done < b->batch) {
+        b->done++;
+        return 1;
+    }
+    i64 elapsed = nanos_() - b->beg;
+    if (elapsed < 250000000) {
+        b->batch *= 2;
+        b->done++;
+        return 1;
+    }
+    printf("%-28s %12lld %12.1f ns/op\n",
+           b->name, (long long)b->done, (double)elapsed/(double)b->done);
+    fflush(stdout);
+    return 0;
+}
+
+#define BENCH(name) for (bench b_ = newbench_(name); running_(&b_);)
+
+static void printint_(u8buf *b, i32 x)
+{
+    u8  mem[16];
+    u8 *end = mem + countof(mem);
+    u8 *p   = end;
+    do {
+        *--p = (u8)('0' + x%10);
+    } while (x /= 10);
+    prints8(b, s8span(p, end));
+}
+
+// A .pc file with a typical prefix block, some extra variables, and
+// populated flags fields, named "pkgN" and requiring the given names.
+static s8 genpc_(arena *perm, i32 n, s8 requires, s8 private)
+{
+    u8buf b = newmembuf(perm);
+    prints8(&b, S("prefix=/opt/pkg"));
+    printint_(&b, n);
+    prints8(&b, S(
+        "\nexec_prefix=${prefix}\n"
+        "libdir=${exec_prefix}/lib\n"
+        "includedir=${prefix}/include\n"
+        "datadir=${prefix}/share\n"
+        "pluginsdir=${libdir}/plugins\n"
+        "api_version=2.0\n"
+        "\n"
+        "Name: pkg"
+    ));
+    printint_(&b, n);
+    prints8(&b, S(
+        "\nDescription: Synthetic package for benchmarks\n"
+        "Version: 1.2."
+    ));
+    printint_(&b, n);
+    prints8(&b, S("\nRequires: "));
+    prints8(&b, requires);
+    prints8(&b, S("\nRequires.private: "));
+    prints8(&b, private);
+    prints8(&b, S(
+        "\nCflags: -I${includedir}/pkg-${api_version} -I${includedir} "
+        "-DPKG_PLUGINS=\\\"${pluginsdir}\\\" -pthread\n"
+        "Libs: -L${libdir} -lpkg"
+    ));
+    printint_(&b, n);
+    prints8(&b, S(
+        " -Wl,-rpath,${libdir}\n"
+        "Libs.private: -lm -ldl -lpthread -lz\n"
+    ));
+    return finalize(&b);
+}
+
+static s8 nameof_(arena *perm, i32 n)
+{
+    u8buf b = newmembuf(perm);
+    prints8(&b, S("pkg"));
+    printint_(&b, n);
+    return finalize(&b);
+}
+
+static s8 pathof_(arena *perm, s8 dir, s8 name)
+{
+    u8buf b = newmembuf(perm);
+    prints8(&b, dir);
+    printu8(&b, '/');
+    prints8(&b, name);
+    prints8(&b, S(".pc"));
+    return finalize(&b);
+}
+
+// Install a package tree: a chain of "depth" packages, each requiring
+// the next and "width" leaves, found in the last of several search
+// directories so that every lookup misses first.
+static config newtree_(arena *perm, os *ctx, i32 depth, i32 width)
+{
+    static const s8 dirs[] = {
+        s8("/opt/a/pkgconfig"), s8("/opt/b/pkgconfig"),
+        s8("/usr/local/lib/pkgconfig"), s8("/usr/lib/pkgconfig"),
+    };
+    s8 dir = dirs[countof(dirs)-1];
+
+    i32 leaves = depth;
+    for (i32 i = 0; i < depth; i++) {
+        u8buf req = newmembuf(perm);
+        if (i+1 < depth) {
+            prints8(&req, S("pkg"));
+            printint_(&req, i+1);
+            prints8(&req, S(" >= 1.0"));
+        }
+        for (i32 j = 0; j < width; j++) {
+            prints8(&req, S(", pkg"));
+            printint_(&req, leaves + j);
+        }
+        s8 requires = finalize(&req);
+        s8 name = nameof_(perm, i);
+        *insert(&ctx->filesystem, pathof_(perm, dir, name), 0, perm) =
+            genpc_(perm, i, requires, S(""));
+    }
+    for (i32 j = 0; j < width; j++) {
+        s8 name = nameof_(perm, leaves+j);
+        *insert(&ctx->filesystem, pathof_(perm, dir, name), 0, perm) =
+            genpc_(perm, leaves+j, S(""), S(""));
+    }
+
+    config conf = {0};
+    conf.delim = ':';
+    conf.sys_incpath = S("/usr/include");
+    conf.sys_libpath = S("/lib:/usr/lib");
+    conf.fixedpath = S(
+        "/opt/a/pkgconfig:/opt/b/pkgconfig:"
+        "/usr/local/lib/pkgconfig:/usr/lib/pkgconfig"
+    );
+    conf.haslisting = 1;
+    conf.perm.ctx = ctx;
+    return conf;
+}
+
+static void run_(config conf, arena a, u8 **args, i32 nargs)
+{
+    os *ctx = conf.perm.ctx;
+    conf.perm.beg = a.beg;
+    conf.perm.end = a.end;
+    conf.args = args;
+    conf.nargs = nargs;
+    if (!setjmp(ctx->exit)) {
+        uconfig(&conf);
+    }
+}
+
+static void bench_hash(os *ctx)
+{
+    s8 names[] = {
+        S("prefix"), S("exec_prefix"), S("libdir"), S("includedir"),
+        S("pc_sysrootdir"), S("gobject-introspection-1.0"),
+    };
+    u32 seed = 0;
+    BENCH("s8hash") {
+        for (iz i = 0; i < countof(names); i++) {
+            ctx->sink += s8hash(names[i], seed++);
+        }
+    }
+}
+
+static void bench_versions(os *ctx)
+{
+    s8 pairs[][2] = {
+        {S("1.2.3"),          S("1.2.10")},
+        {S("2.76.4"),         S("2.76.4")},
+        {S("1.0~rc1"),        S("1.0")},
+        {S("20230801"),       S("2023.08.01")},
+        {S("3.0.0-beta.2"),   S("3.0.0-beta.10")},
+        {S("0.29.2"),         S("0.9")},
+    };
+    BENCH("compareversions") {
+        for (iz i = 0; i < countof(pairs); i++) {
+            ctx->sink += (u32)compareversions(pairs[i][0], pairs[i][1]);
+        }
+    }
+}
+
+static void bench_dequote(os *ctx, arena scratch)
+{
+    s8 line = S(
+        "-I/usr/include/glib-2.0 -I/usr/lib/glib-2.0/include "
+        "-DG_LOG_DOMAIN=\\\"GLib\\\" '-DNAME=\"two words\"' "
+        "-I\"/opt/Program Files/include\" -pthread -mfpmath=sse "
+        "-msse -msse2 -DFOO -DBAR=1 -I/usr/include/libmount "
+        "-I/usr/include/blkid -I/usr/include/sysprof-4"
+    );
+    BENCH("dequote") {
+        arena a = scratch;
+        dequoted r = dequote(line, &a);
+        for (; r.arg.len; r = dequote(r.tail, &a)) {
+            ctx->sink += (u32)r.arg.len;
+        }
+    }
+}
+
+static void bench_parse(os *ctx, arena scratch)
+{
+    s8 pc = genpc_(&scratch, 0, S("glib-2.0 >= 2.50, gobject-2.0"), S("zlib"));
+    BENCH("parsepackage") {
+        arena a = scratch;
+        parseresult r = parsepackage(pc, 0, &a);
+        ctx->sink += (u32)r.err;
+    }
+}
+
+static void bench_expand(os *ctx, arena scratch)
+{
+    env *global = 0;
+    *insert(&global, S("pc_sysrootdir"), 0, &scratch) = S("/");
+    *insert(&global, S("pc_top_builddir"), 0, &scratch) = S("$(top_builddir)");
+    env *vars = 0;
+    *insert(&vars, S("prefix"), 0, &scratch) = S("/usr");
+    *insert(&vars, S("exec_prefix"), 0, &scratch) = S("${prefix}");
+    *insert(&vars, S("libdir"), 0, &scratch) = S("${exec_prefix}/lib");
+    *insert(&vars, S("includedir"), 0, &scratch) = S("${prefix}/include");
+    *insert(&vars, S("pluginsdir"), 0, &scratch) = S("${libdir}/plugins");
+    s8 field = S(
+        "-I${includedir}/gstreamer-1.0 -I${includedir} "
+        "-DPLUGINS=\"${pluginsdir}\" -L${libdir} -lgstreamer-1.0"
+    );
+    u8buf *err = newnullout(&scratch);
+    BENCH("expand") {
+        arena a = scratch;
+        u8buf out = newmembuf(&a);
+        expand(&out, err, global, vars, S("bench.pc"), field);
+        ctx->sink += (u32)out.len;
+    }
+}
+
+static void bench_uconfig(os *ctx, arena scratch)
+{
+    config conf = newtree_(&scratch, ctx, 8, 4);
+    iz cap = (iz)1<<22;
+    arena a = {0};
+    a.beg = new(&scratch, byte, cap);
+    a.end = a.beg + cap;
+    a.ctx = ctx;
+
+    u8 *version[]  = {S("--version").s};
+    u8 *modver[]   = {S("--modversion").s, S("pkg7").s};
+    u8 *exists[]   = {S("--exists").s, S("pkg0").s};
+    u8 *cflags[]   = {S("--cflags").s, S("pkg0").s};
+    u8 *libs[]     = {S("--cflags").s, S("--libs").s, S("pkg0").s};
+    u8 *static_[]  = {S("--static").s, S("--libs").s, S("pkg0").s};
+    u8 *listall[]  = {S("--list-all").s};
+
+    BENCH("uconfig --version") {
+        run_(conf, a, version, countof(version));
+    }
+    BENCH("uconfig --modversion") {
+        run_(conf, a, modver, countof(modver));
+    }
+    BENCH("uconfig --exists") {
+        run_(conf, a, exists, countof(exists));
+    }
+    BENCH("uconfig --cflags") {
+        run_(conf, a, cflags, countof(cflags));
+    }
+    BENCH("uconfig --cflags --libs") {
+        run_(conf, a, libs, countof(libs));
+    }
+    BENCH("uconfig --static --libs") {
+        run_(conf, a, static_, countof(static_));
+    }
+    BENCH("uconfig --list-all") {
+        run_(conf, a, listall, countof(listall));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        filter_ = argv[1];
+    }
+
+    iz cap = (iz)1<<24;
+    arena a = {0};
+    a.beg = malloc((size_t)cap);
+    if (!a.beg) {
+        return 1;
+    }
+    a.end = a.beg + cap;
+    os *ctx = new(&a, os, 1);
+    a.ctx = ctx;
+
+    printf("%-28s %12s %15s\n", "benchmark", "iterations", "time");
+    bench_hash(ctx);
+    bench_versions(ctx);
+    bench_dequote(ctx, a);
+    bench_parse(ctx, a);
+    bench_expand(ctx, a);
+    bench_uconfig(ctx, a);
+    return ctx->sink == 1;  // practically never
+}
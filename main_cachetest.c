@@ -0,0 +1,271 @@
+// Tests for the POSIX shared package cache ($PKG_CONFIG_CACHE)
+//   $ cc -g3 -Wall -Wextra -o cachetest main_cachetest.c
+//   $ ./cachetest
+//
+// Drives the cache through the POSIX platform layer's os_mapfile() and
+// os_listing() on real files in a temporary directory: publish, lookup,
+// replacement of a stale entry, misses answered from directory listings,
+// rejection of a corrupt cache, the entry limit, and reset once full. The
+// cache refuses to publish files changed within the last second, judging
+// by ctime, which cannot be backdated, so the tests sleep after writing
+// files. Calls to stat(2) from the platform layer are counted.
+//
+// This is free and unencumbered software released into the public domain.
+#include <sys/stat.h>
+
+static int nstats;
+
+static int countstat_(const char *path, struct stat *st)
+{
+    nstats++;
+    return stat(path, st);
+}
+
+#define main uconfig_main_
+#define stat(path, st) countstat_(path, st)
+#include "main_posix.c"
+#undef stat
+#undef main
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+static char dir[] = "/tmp/cachetest.XXXXXX";
+static char pkgdir[256];
+static char cachepath[256];
+static int  failures;
+
+#define EXPECT(c) \
+    do { \
+        if (!(c)) { \
+            printf("%s:%d: FAIL: %s\n", __FILE__, __LINE__, #c); \
+            failures++; \
+        } \
+    } while (0)
+
+static s8 pathz(char *name)
+{
+    static char buf[4][256];
+    static int  n;
+    char *p = buf[n++ % countof(buf)];
+    snprintf(p, sizeof(buf[0]), "%s%s%s", pkgdir, *name ? "/" : "", name);
+    s8 r = s8fromcstr((u8 *)p);
+    r.len++;  // include terminator
+    return r;
+}
+
+// Write a file with its mtime backdated by an hour plus some seconds, so
+// that rewrites of the same size still look different to stat(2).
+static void writefile(char *name, char *data, int age)
+{
+    s8 path = pathz(name);
+    FILE *f = fopen((char *)path.s, "w");
+    fputs(data, f);
+    fclose(f);
+    struct timeval tv[2];
+    gettimeofday(tv, 0);
+    tv[0].tv_sec -= 3600 + age;
+    tv[1] = tv[0];
+    utimes((char *)path.s, tv);
+}
+
+static b32 mapped(os *ctx, char *name, char *want)
+{
+    static byte mem[1<<16];
+    arena a = {mem, mem+sizeof(mem), ctx};
+    filemap m = os_mapfile(ctx, &a, pathz(name));
+    return m.status==filemap_OK && s8equals(m.data, s8fromcstr((u8 *)want));
+}
+
+static b32 incache(os *ctx, i32 kind, char *name)
+{
+    s8 path = pathz(name);
+    struct stat st;
+    stat((char *)path.s, &st);
+    return ctx->cache && cachelookup_(ctx, kind, path, &st);
+}
+
+static os opencache(void)
+{
+    os ctx = {0};
+    ctx.cachepath = cachepath;
+    ctx.cache = opencache_(ctx.cachepath);
+    EXPECT(ctx.cache);
+    return ctx;
+}
+
+static void test_roundtrip(void)
+{
+    os ctx = opencache();
+
+    EXPECT(!incache(&ctx, cache_FILE, "a.pc"));
+    EXPECT(!incache(&ctx, cache_LISTING, ""));
+    EXPECT(mapped(&ctx, "a.pc", "Name: a\n"));
+    EXPECT(incache(&ctx, cache_FILE, "a.pc"));
+    EXPECT(incache(&ctx, cache_LISTING, ""));
+    EXPECT(ctx.cache->count == 2);
+
+    // A second process sees the published entry
+    os other = opencache();
+    EXPECT(incache(&other, cache_FILE, "a.pc"));
+    EXPECT(mapped(&other, "a.pc", "Name: a\n"));
+
+    // Stale: same size, different mtime, never served, then replaced
+    writefile("a.pc", "Name: b\n", 1);
+    sleep(2);
+    EXPECT(!incache(&ctx, cache_FILE, "a.pc"));
+    EXPECT(mapped(&ctx, "a.pc", "Name: b\n"));
+    EXPECT(incache(&other, cache_FILE, "a.pc"));
+    EXPECT(mapped(&other, "a.pc", "Name: b\n"));
+    EXPECT(ctx.cache->count == 2);
+
+    // Listings round trip as well
+    static byte mem[1<<12];
+    arena a = {mem, mem+sizeof(mem), &ctx};
+    s8 d = pathz("");
+    s8node *names = os_listing(&ctx, &a, d);
+    i32 count = 0;
+    for (s8node *n = names; n; n = n->next, count++) {}
+    EXPECT(count == 4);
+    names = os_listing(&other, &a, d);
+    for (; names; names = names->next, count--) {}
+    EXPECT(count == 0);
+
+    // Files that are not packages, such as logs, are never cached
+    EXPECT(mapped(&ctx, "log", "log\n"));
+    EXPECT(!incache(&ctx, cache_FILE, "log"));
+    unlink(cachepath);
+}
+
+static void test_misses(void)
+{
+    os first = opencache();
+    EXPECT(mapped(&first, "a.pc", "Name: b\n"));
+
+    // The directory is checked once per run, the hit once, and misses
+    // not at all, whether the directory exists or not
+    os ctx = opencache();
+    nstats = 0;
+    EXPECT(mapped(&ctx, "a.pc", "Name: b\n"));
+    EXPECT(nstats == 2);
+    for (int i = 0; i < 100; i++) {
+        EXPECT(!mapped(&ctx, "missing.pc", ""));
+    }
+    EXPECT(nstats == 2);
+    for (int i = 0; i < 100; i++) {
+        EXPECT(!mapped(&ctx, "nodir/missing.pc", ""));
+    }
+    EXPECT(nstats == 3);
+
+    // A new file changes the directory, so the next run sees it even
+    // before the listing can be published again
+    writefile("new.pc", "Name: new\n", 0);
+    os next = opencache();
+    EXPECT(mapped(&next, "new.pc", "Name: new\n"));
+    EXPECT(!mapped(&next, "missing.pc", ""));
+    sleep(2);
+    os later = opencache();
+    EXPECT(mapped(&later, "new.pc", "Name: new\n"));
+    nstats = 0;
+    EXPECT(!mapped(&later, "missing.pc", ""));
+    EXPECT(nstats == 0);
+    unlink((char *)pathz("new.pc").s);
+    unlink(cachepath);
+}
+
+static void test_corrupt(void)
+{
+    os ctx = opencache();
+    EXPECT(mapped(&ctx, "c.pc", "Name: c\n"));
+
+    // Point every slot past the fill mark: ignored, but still correct
+    cacheheader_ *c = ctx.cache;
+    for (i32 i = 0; i < countof(c->slots); i++) {
+        c->slots[i] = (u32)-1;
+    }
+    EXPECT(mapped(&ctx, "c.pc", "Name: c\n"));
+    EXPECT(!ctx.cache);
+
+    // An entry whose lengths run past the fill mark is just as bad
+    os other = opencache();
+    memset(c->slots, 0, sizeof(c->slots));
+    EXPECT(mapped(&other, "c.pc", "Name: c\n"));
+    EXPECT(other.cache);
+    cacheentry_ *e;
+    EXPECT(cacheslot_(c, cache_FILE, pathz("c.pc"), &e) && e);
+    e->datalen = cache_SIZE;
+    EXPECT(mapped(&other, "c.pc", "Name: c\n"));
+    EXPECT(!other.cache);
+
+    // Outdated layouts are left alone
+    c->tag = cache_MAGIC;
+    os old = {0};
+    old.cache = opencache_(cachepath);
+    EXPECT(!old.cache);
+    unlink(cachepath);
+}
+
+static void test_full(void)
+{
+    // Past the entry limit new keys are not added
+    os ctx = opencache();
+    EXPECT(mapped(&ctx, "f.pc", "Name: f\n"));
+    EXPECT(incache(&ctx, cache_FILE, "f.pc"));
+    ctx.cache->count = cache_LIMIT;
+    EXPECT(mapped(&ctx, "g.pc", "Name: g\n"));
+    EXPECT(!incache(&ctx, cache_FILE, "g.pc"));
+    EXPECT(!ctx.cache->retired);
+
+    // Filling the region unlinks the file, and the next run starts empty
+    ctx.cache->used = cache_SIZE;
+    ctx.cache->count = 0;
+    EXPECT(mapped(&ctx, "g.pc", "Name: g\n"));
+    EXPECT(ctx.cache->retired);
+    EXPECT(incache(&ctx, cache_FILE, "f.pc"));  // still readable
+    os next = opencache();
+    EXPECT(next.cache != ctx.cache);
+    EXPECT(!next.cache->count);
+    EXPECT(mapped(&next, "g.pc", "Name: g\n"));
+    EXPECT(incache(&next, cache_FILE, "g.pc"));
+}
+
+static void cleanup(void)
+{
+    char *names[] = {"a.pc", "c.pc", "f.pc", "g.pc", "new.pc", "log"};
+    for (int i = 0; i < countof(names); i++) {
+        unlink((char *)pathz(names[i]).s);
+    }
+    unlink(cachepath);
+    rmdir(pkgdir);
+    rmdir(dir);
+}
+
+int main(void)
+{
+    if (!mkdtemp(dir)) {
+        printf("could not create %s\n", dir);
+        return 1;
+    }
+    snprintf(pkgdir, sizeof(pkgdir), "%s/pc", dir);
+    snprintf(cachepath, sizeof(cachepath), "%s/cache", dir);
+    mkdir(pkgdir, 0777);
+
+    writefile("a.pc", "Name: a\n", 0);
+    writefile("c.pc", "Name: c\n", 0);
+    writefile("f.pc", "Name: f\n", 0);
+    writefile("g.pc", "Name: g\n", 0);
+    writefile("log", "log\n", 0);
+    sleep(2);
+
+    test_roundtrip();
+    test_misses();
+    test_corrupt();
+    test_full();
+    cleanup();
+    if (failures) {
+        printf("%d cache test failures\n", failures);
+        return 1;
+    }
+    puts("all cache tests pass");
+    return 0;
+}
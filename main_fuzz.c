@@ -26,6 +26,21 @@ static void os_write(os *ctx, i32 fd, s8 s)
     (void)s;
 }
 
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    return 0;
+}
+
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    (void)ctx;
+    (void)scratch;
+    (void)path;
+    (void)data;
+    (void)header;
+}
+
 static filemap os_mapfile(os *ctx, arena *perm, s8 path)
 {
     (void)perm;
@@ -3,14 +3,16 @@
 #include "src/u-config.c"
 
 enum {
-    SYS_close       = 57,
-    SYS_exit        = 93,
-    SYS_openat      = 56,
-    SYS_read        = 63,
-    SYS_write       = 64,
-    SYS_getdents64  = 61,
+    SYS_close         = 57,
+    SYS_exit          = 93,
+    SYS_openat        = 56,
+    SYS_read          = 63,
+    SYS_write         = 64,
+    SYS_getdents64    = 61,
+    SYS_clock_gettime = 113,
+    SYS_getpid        = 172,
 
-    O_DIRECTORY     = 0x4000,
+    O_DIRECTORY       = 0x4000,
 };
 
 #include "src/linux_noarch.c"
@@ -48,3 +50,19 @@ static long syscall3(long n, long a, long b, long c)
     );
     return x0;
 }
+
+static long syscall4(long n, long a, long b, long c, long d)
+{
+    register long x8 asm("x8") = n;
+    register long x0 asm("x0") = a;
+    register long x1 asm("x1") = b;
+    register long x2 asm("x2") = c;
+    register long x3 asm("x3") = d;
+    asm volatile (
+        "svc 0"
+        : "=r"(x0)
+        : "0"(x0), "r"(x8), "r"(x1), "r"(x2), "r"(x3)
+        : "memory", "cc"
+    );
+    return x0;
+}
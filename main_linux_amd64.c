@@ -3,14 +3,16 @@
 #include "src/u-config.c"
 
 enum {
-    SYS_close       = 3,
-    SYS_exit        = 60,
-    SYS_openat      = 257,
-    SYS_read        = 0,
-    SYS_write       = 1,
-    SYS_getdents64  = 217,
+    SYS_close         = 3,
+    SYS_exit          = 60,
+    SYS_openat        = 257,
+    SYS_read          = 0,
+    SYS_write         = 1,
+    SYS_getdents64    = 217,
+    SYS_clock_gettime = 228,
+    SYS_getpid        = 39,
 
-    O_DIRECTORY     = 0x10000,
+    O_DIRECTORY       = 0x10000,
 };
 
 #include "src/linux_noarch.c"
@@ -44,3 +46,16 @@ static long syscall3(long n, long a, long b, long c)
     );
     return r;
 }
+
+static long syscall4(long n, long a, long b, long c, long d)
+{
+    register long r10 asm("r10") = d;
+    long r;
+    asm volatile (
+        "syscall"
+        : "=a"(r)
+        : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10)
+        : "rcx", "r11", "memory"
+    );
+    return r;
+}
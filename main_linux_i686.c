@@ -3,14 +3,16 @@
 #include "src/u-config.c"
 
 enum {
-    SYS_close       = 6,
-    SYS_exit        = 1,
-    SYS_openat      = 295,
-    SYS_read        = 3,
-    SYS_write       = 4,
-    SYS_getdents64  = 220,
+    SYS_close         = 6,
+    SYS_exit          = 1,
+    SYS_openat        = 295,
+    SYS_read          = 3,
+    SYS_write         = 4,
+    SYS_getdents64    = 220,
+    SYS_clock_gettime = 403,  // clock_gettime64
+    SYS_getpid        = 20,
 
-    O_DIRECTORY     = 0x10000,
+    O_DIRECTORY       = 0x10000,
 };
 
 #include "src/linux_noarch.c"
@@ -46,3 +48,15 @@ static long syscall3(long n, long a, long b, long c)
     );
     return r;
 }
+
+static long syscall4(long n, long a, long b, long c, long d)
+{
+    long r;
+    asm volatile (
+        "int $0x80"
+        : "=a"(r)
+        : "a"(n), "b"(a), "c"(b), "d"(c), "S"(d)
+        : "memory"
+    );
+    return r;
+}
@@ -3,14 +3,16 @@
 #include "src/u-config.c"
 
 enum {
-    SYS_close       = 57,
-    SYS_exit        = 93,
-    SYS_openat      = 56,
-    SYS_read        = 63,
-    SYS_write       = 64,
-    SYS_getdents64  = 61,
+    SYS_close         = 57,
+    SYS_exit          = 93,
+    SYS_openat        = 56,
+    SYS_read          = 63,
+    SYS_write         = 64,
+    SYS_getdents64    = 61,
+    SYS_clock_gettime = 113,
+    SYS_getpid        = 172,
 
-    O_DIRECTORY     = 0x10000,
+    O_DIRECTORY       = 0x10000,
 };
 
 #include "src/linux_noarch.c"
@@ -48,3 +50,19 @@ static long syscall3(long n, long a, long b, long c)
     );
     return a0;
 }
+
+static long syscall4(long n, long a, long b, long c, long d)
+{
+    register long a7 asm("a7") = n;
+    register long a0 asm("a0") = a;
+    register long a1 asm("a1") = b;
+    register long a2 asm("a2") = c;
+    register long a3 asm("a3") = d;
+    asm volatile (
+        "ecall"
+        : "=r"(a0)
+        : "0"(a0), "r"(a7), "r"(a1), "r"(a2), "r"(a3)
+        : "memory"
+    );
+    return a0;
+}
@@ -3,7 +3,13 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#  include <sys/auxv.h>
+#endif
 #include "src/u-config.c"
 
 #ifndef PKG_CONFIG_SYSTEM_INCLUDE_PATH
@@ -32,12 +38,300 @@ static const char pkg_config_path[] =
     #endif
 ;
 
+// Shared package cache ($PKG_CONFIG_CACHE)
+//
+// A file-backed region mapped by every process naming the same file.
+// Entries hold package file contents or directory listings, keyed by
+// path, along with the stat(2) results of the source. Entries are
+// immutable once published: writers reserve space by atomically bumping
+// the fill mark, fill it in, then publish with a release CAS on a hash
+// slot. Readers only acquire-load slots, so they never wait, and never
+// observe a torn entry. A changed file simply gets a new entry that
+// replaces the slot, stranding the old one. Offsets and lengths are
+// checked against the fill mark before use, and a cache that fails the
+// checks is ignored for the rest of the run.
+//
+// Directory listings hold the names of the package files in a directory,
+// indexed by hash, and are validated with the directory's own stat(2),
+// which changes whenever a name is added or removed. Each directory is
+// looked up once per run, and a package name missing from its fresh
+// listing is rejected without touching the file system, which is the
+// common case along a long search path.
+//
+// Nothing is freed in place. Once half the slots are occupied, new keys
+// are no longer added. Once the region fills, which stale entries will
+// eventually do, the first process to notice unlinks the file, so the
+// next run starts over with an empty cache while runs still mapping the
+// old one finish undisturbed. Removing the file by hand does the same.
+
+#define cache_TAG ((i64)cache_VERSION<<32 | cache_MAGIC)
+
+enum {
+    cache_MAGIC   = 0x75636663,  // "ucfc"
+    cache_VERSION = 3,           // bump on layout changes
+    cache_EXP     = 15,
+    cache_LIMIT   = 1<<(cache_EXP - 1),  // entries, keeping probes short
+    cache_SIZE    = 1<<25,
+};
+
+enum { cache_FILE = 1, cache_LISTING };
+
+typedef struct {
+    i64 tag;      // cache_TAG, or zero while new
+    i64 used;     // fill mark, in bytes past the slots
+    i32 count;    // occupied slots
+    i32 retired;  // set by the process that unlinks it when full
+    u32 slots[1<<cache_EXP];  // entry offsets in 8-byte units, or zero
+} cacheheader_;
+
+typedef struct {
+    u32 hash;
+    i32 kind;
+    i64 dev;
+    i64 ino;
+    i64 size;
+    i64 mtime;
+    i64 ctime;
+    i64 keylen;
+    i64 datalen;
+    // u8 key[keylen], data[datalen];
+} cacheentry_;
+
+// Directories seen this run, each looked up in the cache once
+enum { cachedirs_EXP = 10 };
+
+typedef struct {
+    s8           path;     // null-terminated, zero when the slot is empty
+    cacheentry_ *listing;  // fresh listing, or null to check files directly
+    b32          missing;  // not a directory, so contains no packages
+} cachedir_;
+
+struct os {
+    cacheheader_ *cache;
+    char         *cachepath;
+    i32           ndirs;
+    cachedir_     dirs[1<<cachedirs_EXP];
+};
+
+static cacheheader_ *opencache_(char *path)
+{
+    if (!path || !*path) {
+        return 0;
+    }
+
+    int fd = open(path, O_RDWR|O_CREAT, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+
+    // Racing creators all extend to the same size, which is harmless
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return 0;
+    }
+    if (st.st_size<cache_SIZE && ftruncate(fd, cache_SIZE)) {
+        close(fd);
+        return 0;
+    }
+
+    void *p = mmap(0, cache_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+
+    cacheheader_ *c = p;
+    i64 tag = 0;
+    __atomic_compare_exchange_n(
+        &c->tag, &tag, cache_TAG, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+    );
+    if (tag && tag!=cache_TAG) {
+        munmap(p, cache_SIZE);  // foreign or outdated, leave it alone
+        return 0;
+    }
+    return c;
+}
+
+// Locate the entry at an offset, or return null if any part of it lies
+// outside the filled region, which only happens in a corrupt cache.
+static cacheentry_ *cacheentry_at_(cacheheader_ *c, u32 off)
+{
+    i64 avail = cache_SIZE - (i64)sizeof(*c);
+    i64 used  = __atomic_load_n(&c->used, __ATOMIC_RELAXED);
+    used = used<avail ? used : avail;  // failed reservations overshoot
+
+    i64 beg  = ((i64)off - 1) * 8;
+    i64 rest = used - beg - (i64)sizeof(cacheentry_);
+    if (beg<0 || rest<0) {
+        return 0;
+    }
+    cacheentry_ *e = (cacheentry_ *)((byte *)(c + 1) + beg);
+    if (e->keylen<0 || e->keylen>rest ||
+        e->datalen<0 || e->datalen>rest-e->keylen) {
+        return 0;
+    }
+    return e;
+}
+
+static s8 cachekey_(cacheentry_ *e)
+{
+    s8 r = {(u8 *)(e + 1), (iz)e->keylen};
+    return r;
+}
+
+static s8 cachedata_(cacheentry_ *e)
+{
+    s8 r = {(u8 *)(e + 1) + e->keylen, (iz)e->datalen};
+    return r;
+}
+
+static b32 cachefresh_(cacheentry_ *e, struct stat *st)
+{
+    return e->dev   == (i64)st->st_dev   &&
+           e->ino   == (i64)st->st_ino   &&
+           e->size  == (i64)st->st_size  &&
+           e->mtime == (i64)st->st_mtime &&
+           e->ctime == (i64)st->st_ctime;
+}
+
+// Find the slot for a key. Returns the slot, and the current entry for
+// that key through *found, or null when the key is absent. Returns null
+// if no slot is usable, after probing the whole table or on corruption.
+static u32 *cacheslot_(cacheheader_ *c, i32 kind, s8 key, cacheentry_ **found)
+{
+    u32 hash = s8hash(key, (u32)kind);
+    u32 mask = ((u32)1<<cache_EXP) - 1;
+    u32 i = hash>>(32 - cache_EXP);
+    *found = 0;
+    for (u32 n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        u32 *slot = c->slots + i;
+        u32 off = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (!off) {
+            return slot;
+        }
+        cacheentry_ *e = cacheentry_at_(c, off);
+        if (!e) {
+            return 0;
+        }
+        if (e->hash==hash && e->kind==kind && s8equals(cachekey_(e), key)) {
+            *found = e;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+static cacheentry_ *cachelookup_(os *ctx, i32 kind, s8 key, struct stat *st)
+{
+    cacheentry_ *e;
+    if (!cacheslot_(ctx->cache, kind, key, &e)) {
+        ctx->cache = 0;  // unusable, so ignore it from here on
+        return 0;
+    }
+    return e && cachefresh_(e, st) ? e : 0;
+}
+
+static void cacheretire_(os *ctx)
+{
+    i32 expect = 0;
+    if (__atomic_compare_exchange_n(
+            &ctx->cache->retired, &expect, 1, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        unlink(ctx->cachepath);
+    }
+}
+
+// Returns the published entry, or null if the data was not published.
+static cacheentry_ *cachepublish_(
+    os *ctx, i32 kind, s8 key, struct stat *st, s8 data)
+{
+    cacheheader_ *c = ctx->cache;
+
+    // A source changed within the clock's granularity may change again
+    // without a visible stat(2) difference, so let it settle first.
+    i64 now = (i64)time(0);
+    if (st->st_mtime>=now-1 || st->st_ctime>=now-1) {
+        return 0;
+    }
+
+    // Past the limit only changed files may replace their entries.
+    // Concurrent publishers may overshoot it by a few entries, which the
+    // half-empty table easily absorbs.
+    cacheentry_ *old;
+    u32 *slot = cacheslot_(c, kind, key, &old);
+    if (!slot ||
+        (!old && __atomic_load_n(&c->count, __ATOMIC_RELAXED)>=cache_LIMIT)) {
+        return 0;
+    }
+
+    iz size = (iz)sizeof(cacheentry_) + key.len + data.len;
+    size = (size + 7) & -8;
+    iz avail = cache_SIZE - (iz)sizeof(*c);
+    i64 beg = __atomic_fetch_add(&c->used, (i64)size, __ATOMIC_RELAXED);
+    if (beg > avail-size) {
+        cacheretire_(ctx);  // the reservation strands the remainder
+        return 0;
+    }
+
+    u32 off = (u32)(beg/8 + 1);
+    cacheentry_ *e = (cacheentry_ *)((byte *)(c + 1) + beg);
+    e->hash    = s8hash(key, (u32)kind);
+    e->kind    = kind;
+    e->dev     = (i64)st->st_dev;
+    e->ino     = (i64)st->st_ino;
+    e->size    = (i64)st->st_size;
+    e->mtime   = (i64)st->st_mtime;
+    e->ctime   = (i64)st->st_ctime;
+    e->keylen  = key.len;
+    e->datalen = data.len;
+    s8copy(cachekey_(e), key);
+    s8copy(cachedata_(e), data);
+
+    // Losing a race only means another process published first
+    u32 expect = old ? (u32)((byte *)old - (byte *)(c + 1))/8 + 1 : 0;
+    if (!__atomic_compare_exchange_n(
+            slot, &expect, off, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    if (!old) {
+        __atomic_fetch_add(&c->count, 1, __ATOMIC_RELAXED);
+    }
+    return e;
+}
+
 static void os_fail(os *ctx)
 {
     (void)ctx;
     _exit(1);
 }
 
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (i64)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    (void)ctx;
+    (void)scratch;
+    assert(!path.s[path.len-1]);
+    int flags = O_WRONLY | O_APPEND | O_CREAT;
+    int fd = open((char *)path.s, flags|O_EXCL, 0666);
+    if (fd < 0) {
+        fd = open((char *)path.s, flags, 0666);
+        data = cuthead(data, header);
+    }
+    if (fd >= 0) {
+        ssize_t r = write(fd, data.s, (size_t)data.len);
+        (void)r;  // best effort, like the cache
+        close(fd);
+    }
+}
+
 static void os_write(os *ctx, i32 fd, s8 s)
 {
     (void)ctx;
@@ -51,15 +345,202 @@ static void os_write(os *ctx, i32 fd, s8 s)
     }
 }
 
+static b32 endswith_(s8 s, s8 suffix)
+{
+    return s.len>=suffix.len && s8equals(taketail(s, suffix.len), suffix);
+}
+
+static u32 load32_(u8 *p)
+{
+    return (u32)p[0] | (u32)p[1]<<8 | (u32)p[2]<<16 | (u32)p[3]<<24;
+}
+
+static void store32_(u8 *p, u32 v)
+{
+    p[0] = (u8)v; p[1] = (u8)(v>>8); p[2] = (u8)(v>>16); p[3] = (u8)(v>>24);
+}
+
+// Listings are cached as a hash index followed by null-terminated names.
+// The index is a little-endian slot count, a power of two, then that many
+// slots, each zero or one past the offset of a name.
+static s8 packlisting_(s8node *names, arena *a)
+{
+    iz count = 0;
+    iz len = 0;
+    for (s8node *n = names; n; n = n->next) {
+        count++;
+        len += n->str.len + 1;
+    }
+    u32 nslots = 1;
+    for (; nslots < count*2; nslots *= 2) {}
+    u32 mask = nslots - 1;
+
+    iz index = 4 + 4*(iz)nslots;
+    s8 r = news8(a, index + len);
+    fillbytes((byte *)r.s, 0, index);
+    store32_(r.s, nslots);
+    u8 *p = r.s + index;
+    for (s8node *n = names; n; n = n->next) {
+        u32 i = s8hash(n->str, 0) & mask;
+        for (; load32_(r.s + 4 + 4*i); i = (i + 1) & mask) {}
+        store32_(r.s + 4 + 4*i, (u32)(p - (r.s + index)) + 1);
+        s8copy((s8){p, n->str.len}, n->str);
+        p[n->str.len] = 0;
+        p += n->str.len + 1;
+    }
+    return r;
+}
+
+// The names following a listing's index, or null if malformed.
+static s8 listingnames_(s8 data)
+{
+    s8 r = {0};
+    if (data.len < 4) {
+        return r;
+    }
+    u32 nslots = load32_(data.s);
+    if (!nslots || nslots&(nslots-1) || nslots>(u32)(data.len-4)/4) {
+        return r;
+    }
+    return cuthead(data, 4 + 4*(iz)nslots);
+}
+
+// Is the name in the listing? Malformed listings claim every name, so
+// that the caller checks the file system instead.
+static b32 listed_(s8 data, s8 name)
+{
+    s8 names = listingnames_(data);
+    if (!names.s) {
+        return 1;
+    }
+    u32 nslots = load32_(data.s);
+    u32 mask = nslots - 1;
+    u32 i = s8hash(name, 0) & mask;
+    for (u32 n = 0; n < nslots; n++, i = (i + 1) & mask) {
+        u32 off = load32_(data.s + 4 + 4*i);
+        if (!off) {
+            return 0;
+        } else if (off > names.len) {
+            return 1;
+        }
+        s8 tail = cuthead(names, off - 1);
+        if (tail.len>name.len && !tail.s[name.len] &&
+            s8equals(takehead(tail, name.len), name)) {
+            return 1;
+        }
+    }
+    return 1;
+}
+
+// Package file names in a directory, or null with *ok cleared on error.
+static s8node *readlisting_(char *path, arena *a, b32 *ok)
+{
+    // NOTE: will allocate while holding this handle
+    DIR *handle = opendir(path);
+    *ok = !!handle;
+    if (!handle) {
+        return 0;
+    }
+
+    s8list files = {0};
+    for (struct dirent *d; (d = readdir(handle));) {
+        s8 name = s8fromcstr((u8 *)d->d_name);
+        if (endswith_(name, S(".pc"))) {
+            s8 copy = news8(a, name.len);
+            s8copy(copy, name);
+            append(&files, copy, a);
+        }
+    }
+
+    closedir(handle);
+    return files.head;
+}
+
+// Look up a directory for this run: stat(2) it once, and use or publish
+// its listing. Returns null when the table is too full to remember it.
+static cachedir_ *finddir_(os *ctx, s8 path, arena scratch)
+{
+    u32 mask = ((u32)1<<cachedirs_EXP) - 1;
+    u32 i = s8hash(path, 0) >> (32 - cachedirs_EXP);
+    cachedir_ *d = ctx->dirs + i;
+    for (; d->path.s; i = (i + 1) & mask, d = ctx->dirs + i) {
+        if (s8equals(d->path, path)) {
+            return d;
+        }
+    }
+    if (ctx->ndirs >= (1<<cachedirs_EXP)/2) {
+        return 0;
+    }
+    u8 *copy = malloc((size_t)path.len);
+    if (!copy) {
+        return 0;
+    }
+    ctx->ndirs++;
+    d->path = (s8){copy, path.len};
+    s8copy(d->path, path);
+
+    struct stat st;
+    if (stat((char *)path.s, &st) || !S_ISDIR(st.st_mode)) {
+        d->missing = 1;
+        return d;
+    }
+
+    cacheentry_ *e = ctx->cache ?
+        cachelookup_(ctx, cache_LISTING, path, &st) : 0;
+    if (!e && ctx->cache) {
+        b32 ok;
+        s8node *names = readlisting_((char *)path.s, &scratch, &ok);
+        if (ok) {
+            s8 data = packlisting_(names, &scratch);
+            e = cachepublish_(ctx, cache_LISTING, path, &st, data);
+        }
+    }
+    d->listing = e;
+    return d;
+}
+
 static filemap os_mapfile(os *ctx, arena *perm, s8 path)
 {
-    (void)ctx;
     assert(path.s);
     assert(path.len);
     assert(!path.s[path.len-1]);
 
     filemap r = {0};
 
+    // Only package files are cached, not, say, $PKG_CONFIG_LOG
+    struct stat st;
+    b32 cached = ctx->cache && endswith_(path, S(".pc\0"));
+    if (cached) {
+        iz slash = path.len - 1;
+        for (; slash>0 && path.s[slash-1]!='/'; slash--) {}
+        if (slash) {
+            arena scratch = *perm;
+            iz dirlen = slash>1 ? slash-1 : 1;  // keep the root's slash
+            s8 dir = news8(&scratch, dirlen+1);
+            s8copy(dir, takehead(path, dirlen)).s[0] = 0;
+            s8 name = cuttail(cuthead(path, slash), 1);
+            cachedir_ *d = finddir_(ctx, dir, scratch);
+            if (d && (d->missing ||
+                      (d->listing && !listed_(cachedata_(d->listing), name)))) {
+                r.status = filemap_NOTFOUND;
+                return r;
+            }
+            cached = !!ctx->cache;  // unless found corrupt
+        }
+    }
+    if (cached) {
+        if (stat((char *)path.s, &st) || !S_ISREG(st.st_mode)) {
+            r.status = filemap_NOTFOUND;
+            return r;
+        }
+        cacheentry_ *e = cachelookup_(ctx, cache_FILE, path, &st);
+        if (e) {
+            r.data = cachedata_(e);
+            r.status = filemap_OK;
+            return r;
+        }
+    }
+
     int fd = open((char *)path.s, 0);
     if (fd < 0) {
         r.status = filemap_NOTFOUND;
@@ -86,39 +567,43 @@ static filemap os_mapfile(os *ctx, arena *perm, s8 path)
 
     perm->beg += r.data.len;
     r.status = filemap_OK;
+    if (cached && ctx->cache) {
+        cachepublish_(ctx, cache_FILE, path, &st, r.data);
+    }
     return r;
 }
 
-static b32 endswith_(s8 s, s8 suffix)
+static s8node *cachedlisting_(s8 names, arena *a)
 {
-    return s.len>=suffix.len && s8equals(taketail(s, suffix.len), suffix);
+    s8list files = {0};
+    while (names.len) {
+        iz len = 0;
+        for (; len<names.len && names.s[len]; len++) {}
+        append(&files, takehead(names, len), a);
+        names = cuthead(names, len<names.len ? len+1 : len);
+    }
+    return files.head;
 }
 
 static s8node *os_listing(os *ctx, arena *a, s8 path)
 {
-    (void)ctx;
     assert(path.s);
     assert(path.len);
     assert(!path.s[path.len-1]);
 
-    // NOTE: will allocate while holding this handle
-    DIR *handle = opendir((char *)path.s);
-    if (!handle) {
+    cachedir_ *d = ctx->cache ? finddir_(ctx, path, *a) : 0;
+    if (d && d->missing) {
         return 0;
     }
-
-    s8list files = {0};
-    for (struct dirent *d; (d = readdir(handle));) {
-        s8 name = s8fromcstr((u8 *)d->d_name);
-        if (endswith_(name, S(".pc"))) {
-            s8 copy = news8(a, name.len);
-            s8copy(copy, name);
-            append(&files, copy, a);
-        }
+    s8 names = {0};
+    if (d && d->listing) {
+        names = listingnames_(cachedata_(d->listing));
     }
-
-    closedir(handle);
-    return files.head;
+    if (names.s) {
+        return cachedlisting_(names, a);
+    }
+    b32 ok;
+    return readlisting_((char *)path.s, a, &ok);
 }
 
 static arena newarena_(void)
@@ -137,6 +622,10 @@ static arena newarena_(void)
 static config *newconfig_(void)
 {
     arena perm = newarena_();
+    os *ctx = new(&perm, os, 1);
+    ctx->cachepath = getenv("PKG_CONFIG_CACHE");
+    ctx->cache = opencache_(ctx->cachepath);
+    perm.ctx = ctx;
     config *conf = new(&perm, config, 1);
     conf->perm = perm;
     conf->haslisting = 1;
@@ -148,10 +637,35 @@ static s8 s8getenv_(char *k)
     return s8fromcstr((u8 *)getenv(k));
 }
 
+// Seed for hash tables keyed by untrusted input. Prefer the kernel's
+// random bytes, else mix the stack address (ASLR), clock, and PID.
+static u32 newseed_(void)
+{
+    #if defined(__linux__) && defined(AT_RANDOM)
+    u8 *r = (u8 *)getauxval(AT_RANDOM);
+    if (r) {
+        return (u32)r[0]     | (u32)r[1]<<8 |
+               (u32)r[2]<<16 | (u32)r[3]<<24;
+    }
+    #elif defined(__APPLE__) || defined(__FreeBSD__) || \
+          defined(__OpenBSD__) || defined(__NetBSD__)
+    return arc4random();
+    #endif
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    i64 mix[] = {
+        (i64)(size_t)&ts,
+        (i64)ts.tv_sec*1000000000 + ts.tv_nsec,
+        (i64)getpid(),
+    };
+    return s8hash((s8){(u8 *)mix, sizeof(mix)}, 0);
+}
+
 int main(int argc, char **argv)
 {
     config *conf = newconfig_();
     conf->delim = ':';
+    conf->seed = newseed_();
 
     if (argc) {
         argc--;
@@ -179,6 +693,11 @@ int main(int argc, char **argv)
     conf->top_builddir = s8getenv_("PKG_CONFIG_TOP_BUILD_DIR");
     conf->print_sysinc = s8getenv_("PKG_CONFIG_ALLOW_SYSTEM_CFLAGS");
     conf->print_syslib = s8getenv_("PKG_CONFIG_ALLOW_SYSTEM_LIBS");
+    conf->tracefile = s8getenv_("PKG_CONFIG_TRACE");
+    conf->tracefile.len += !!conf->tracefile.s;  // include terminator
+    conf->logfile = s8getenv_("PKG_CONFIG_LOG");
+    conf->logfile.len += !!conf->logfile.s;
+    conf->pid = (i32)getpid();
 
     uconfig(conf);
     return 0;
@@ -0,0 +1,470 @@
+// Snapshot generator: embeds .pc files into a u-config build
+//   $ cc -o snapshot main_snapshot.c
+//   $ ./snapshot [-p] DIR... >snapshot.h
+//   $ cc -I. -DPKG_CONFIG_SNAPSHOT='"snapshot.h"' ... main_PLATFORM.c
+//
+// Every .pc file in each DIR is embedded with pre-parsed variables and
+// fields. Fields are also pre-expanded where expansion only depends on
+// the package itself, which at run time holds unless variables are
+// defined with --define-variable. Use -p for platforms which default to
+// --define-prefix (Windows). Each DIR must be spelled exactly as in the
+// run-time search path, and the embedded directories are never read at
+// run time. A DIR with a broken .pc file is not embedded, and is instead
+// searched at run time as usual.
+//
+// This is free and unencumbered software released into the public domain.
+#include <dirent.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "src/u-config.c"
+
+struct os {
+    jmp_buf *exit;  // innermost recovery point
+};
+
+static void os_fail(os *ctx)
+{
+    longjmp(*ctx->exit, 1);
+}
+
+static void os_write(os *ctx, i32 fd, s8 s)
+{
+    (void)ctx;
+    while (s.len) {
+        ssize_t r = write(fd, s.s, (size_t)s.len);
+        if (r < 0) {
+            _exit(1);
+        }
+        s = cuthead(s, (iz)r);
+    }
+}
+
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    return 0;
+}
+
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    (void)ctx;
+    (void)scratch;
+    (void)path;
+    (void)data;
+    (void)header;
+}
+
+static filemap os_mapfile(os *ctx, arena *perm, s8 path)
+{
+    (void)ctx;
+    filemap r = {0};
+
+    int fd = open((char *)path.s, 0);
+    if (fd < 0) {
+        r.status = filemap_NOTFOUND;
+        return r;
+    }
+
+    r.data.s = (u8 *)perm->beg;
+    iz cap = perm->end - perm->beg;
+    while (r.data.len < cap) {
+        u8 *dst = r.data.s + r.data.len;
+        ssize_t len = read(fd, dst, (size_t)(cap-r.data.len));
+        if (len < 1) {
+            break;
+        }
+        r.data.len += len;
+    }
+    close(fd);
+
+    if (r.data.len == cap) {
+        r.status = filemap_READERR;
+        return r;
+    }
+
+    perm->beg += r.data.len;
+    r.status = filemap_OK;
+    return r;
+}
+
+static s8node *os_listing(os *ctx, arena *a, s8 path)
+{
+    (void)ctx;
+    DIR *handle = opendir((char *)path.s);
+    if (!handle) {
+        return 0;
+    }
+
+    s8list files = {0};
+    for (struct dirent *d; (d = readdir(handle));) {
+        s8 name = s8fromcstr((u8 *)d->d_name);
+        if (name.len>3 && s8equals(taketail(name, 3), S(".pc"))) {
+            s8 copy = news8(a, name.len);
+            s8copy(copy, name);
+            append(&files, copy, a);
+        }
+    }
+
+    closedir(handle);
+    return files.head;
+}
+
+static void printi32_(u8buf *out, i32 x)
+{
+    u8  buf[16];
+    u8 *e = buf + countof(buf);
+    u8 *p = e;
+    do {
+        *--p = (u8)(x%10) + '0';
+    } while (x /= 10);
+    prints8(out, s8span(p, e));
+}
+
+static void printhex_(u8buf *out, u32 x)
+{
+    prints8(out, S("0x"));
+    for (i32 i = 28; i >= 0; i -= 4) {
+        printu8(out, (u8)"0123456789abcdef"[x>>i & 15]);
+    }
+}
+
+// Print as a C string literal, escaping everything outside of plain
+// printable ASCII, and split across lines every so often.
+static void printliteral_(u8buf *out, s8 s, s8 indent)
+{
+    printu8(out, '"');
+    for (iz i = 0, col = 0; i < s.len; i++) {
+        u8 c = s.s[i];
+        if (col >= 60) {
+            prints8(out, S("\"\n"));
+            prints8(out, indent);
+            printu8(out, '"');
+            col = 0;
+        }
+        if (c>=' ' && c<='~' && c!='"' && c!='\\' && c!='?') {
+            printu8(out, c);
+            col++;
+        } else {
+            printu8(out, '\\');
+            printu8(out, '0' + (c>>6));
+            printu8(out, '0' + (c>>3 & 7));
+            printu8(out, '0' + (c & 7));
+            col += 4;
+        }
+    }
+    printu8(out, '"');
+}
+
+static void prints8lit_(u8buf *out, s8 s, s8 indent)
+{
+    if (!s.s) {
+        prints8(out, S("{0}"));
+    } else {
+        prints8(out, S("s8("));
+        printliteral_(out, s, indent);
+        printu8(out, ')');
+    }
+}
+
+typedef struct {
+    s8  realname;
+    s8  path;
+    s8 *vars;
+    i32 nvars;
+    i32 dir;
+    s8  fields[PKG_NFIELDS];
+    s8  expanded;  // null if not pre-expanded
+    i32 ends[PKG_NFIELDS];
+} entry_;
+
+static b32 isbuiltin_(s8 name)
+{
+    // Must agree with the globals defined in uconfig()
+    static const s8 builtins[] = {
+        s8("pc_path"),
+        s8("pc_system_includedirs"),
+        s8("pc_system_libdirs"),
+        s8("pc_sysrootdir"),
+        s8("pc_top_builddir"),
+    };
+    for (i32 i = 0; i < countof(builtins); i++) {
+        if (s8equals(builtins[i], name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Load a package exactly as findpackage() and process() would, then try
+// to expand it with no global variables.
+static b32 load_(
+    entry_ *e, s8 dir, s8 name, b32 define_prefix, u8buf *err, arena *perm)
+{
+    os *ctx = perm->ctx;
+    jmp_buf *outer = ctx->exit;
+    jmp_buf  inner;
+    ctx->exit = &inner;
+
+    search dirs = newsearch(':');
+    append(&dirs.list, dir, perm);
+
+    pcfile pc = {0};
+    arena rollback = *perm;
+    if (setjmp(inner)) {
+        *perm = rollback;
+        ctx->exit = outer;
+        return 0;
+    }
+    pc = findpackage(&dirs, err, name, 0, 0, perm);
+
+    e->realname = pc.realname;
+    e->path     = pc.path;
+    e->nvars    = pc.env->len;
+    e->vars     = new(perm, s8, 2*e->nvars);
+    b32 usesbuiltin = 0;
+    for (i32 i = 0; i < pc.env->len; i++) {
+        binding *b = pc.env->vars + i;
+        e->vars[2*i+0] = b->name;
+        e->vars[2*i+1] = b->value;
+        usesbuiltin |= isbuiltin_(b->name);
+    }
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        e->fields[i] = pc.fields[i];
+    }
+
+    if (usesbuiltin) {
+        ctx->exit = outer;
+        return 1;  // globals would override these at run time
+    }
+
+    arena expansion = *perm;
+    if (setjmp(inner)) {
+        *perm = expansion;
+        ctx->exit = outer;
+        return 1;  // not pre-expanded, so expanded at run time
+    }
+    if (define_prefix) {
+        setprefix(&pc, perm);
+    }
+    pkg p = {0};
+    expandmerge(newnullout(perm), 0, &p, &pc, perm);
+    e->expanded = s8span(p.data, p.data+p.ends[PKG_NFIELDS-1]);
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        e->ends[i] = p.ends[i];
+    }
+    ctx->exit = outer;
+    return 1;
+}
+
+static void sort_(s8 *a, iz len)
+{
+    for (iz i = 1; i < len; i++) {
+        for (iz j = i; j>0; j--) {
+            s8 x = a[j-1];
+            s8 y = a[j];
+            iz n = x.len<y.len ? x.len : y.len;
+            i32 d = u8compare(x.s, y.s, n);
+            if (d<0 || (!d && x.len<=y.len)) {
+                break;
+            }
+            a[j-1] = y;
+            a[j]   = x;
+        }
+    }
+}
+
+static void emit_(u8buf *out, s8 *dirs, i32 ndirs, entry_ *es, i32 len, b32 p)
+{
+    s8 indent = S("        ");
+    prints8(out, S("// Generated by main_snapshot.c, do not edit\n\n"));
+
+    // C has no empty arrays, so empty tables are left out, and refer to
+    // them as null pointers.
+    if (ndirs) {
+        prints8(out, S("static s8 embedded_dirs[] = {\n"));
+        for (i32 i = 0; i < ndirs; i++) {
+            prints8(out, S("    "));
+            prints8lit_(out, dirs[i], indent);
+            prints8(out, S(",\n"));
+        }
+        prints8(out, S("};\n\n"));
+    }
+
+    i32 nvars = 0;
+    for (i32 i = 0; i < len; i++) {
+        nvars += es[i].nvars;
+    }
+    if (nvars) {
+        prints8(out, S("static s8 embedded_vars[] = {\n"));
+        for (i32 i = 0; i < len; i++) {
+            for (i32 v = 0; v < es[i].nvars; v++) {
+                prints8(out, S("    "));
+                prints8lit_(out, es[i].vars[2*v+0], indent);
+                prints8(out, S(", "));
+                prints8lit_(out, es[i].vars[2*v+1], indent);
+                prints8(out, S(",\n"));
+            }
+        }
+        prints8(out, S("};\n\n"));
+    }
+
+    if (len) {
+        prints8(out, S("static snapshotpkg embedded_pkgs[] = {\n"));
+    }
+    i32 offset = 0;
+    for (i32 i = 0; i < len; i++) {
+        entry_ *e = es + i;
+        prints8(out, S("    {\n        "));
+        prints8lit_(out, e->realname, indent);
+        prints8(out, S(",\n        "));
+        prints8lit_(out, e->path, indent);
+        if (e->nvars) {
+            prints8(out, S(",\n        embedded_vars+"));
+            printi32_(out, offset);
+        } else {
+            prints8(out, S(",\n        0"));
+        }
+        prints8(out, S(", "));
+        printi32_(out, e->nvars);
+        prints8(out, S(", "));
+        printi32_(out, e->dir);
+        prints8(out, S(",\n        {\n"));
+        for (i32 f = 0; f < PKG_NFIELDS; f++) {
+            prints8(out, S("            "));
+            prints8lit_(out, e->fields[f], S("            "));
+            prints8(out, S(",\n"));
+        }
+        prints8(out, S("        },\n        "));
+        if (e->expanded.s) {
+            prints8(out, S("(u8 *)"));
+            printliteral_(out, e->expanded, indent);
+        } else {
+            printu8(out, '0');
+        }
+        prints8(out, S(",\n        {"));
+        for (i32 f = 0; f < PKG_NFIELDS; f++) {
+            prints8(out, f ? S(", ") : S(""));
+            printi32_(out, e->ends[f]);
+        }
+        prints8(out, S("},\n        "));
+        printhex_(out, s8hash(e->realname, 0));
+        prints8(out, S(",\n    },\n"));
+        offset += 2*e->nvars;
+    }
+    if (len) {
+        prints8(out, S("};\n\n"));
+    }
+
+    prints8(out, S("static snapshot embedded = {\n    "));
+    prints8(out, ndirs ? S("embedded_dirs") : S("0"));
+    prints8(out, S(", "));
+    printi32_(out, ndirs);
+    prints8(out, S(",\n    "));
+    prints8(out, len ? S("embedded_pkgs") : S("0"));
+    prints8(out, S(", "));
+    printi32_(out, len);
+    prints8(out, S(",\n    "));
+    printi32_(out, p);
+    prints8(out, S(",\n};\n"));
+}
+
+static i32 snapshot_(i32 argc, char **argv, arena perm)
+{
+    u8buf *out = newfdbuf(&perm, 1, 1<<16);
+    u8buf *err = newfdbuf(&perm, 2, 1<<12);
+
+    b32 define_prefix = 0;
+    i32 first = 1;
+    if (argc>1 && s8equals(s8fromcstr((u8 *)argv[1]), S("-p"))) {
+        define_prefix = 1;
+        first++;
+    }
+    if (first >= argc) {
+        prints8(err, S("usage: snapshot [-p] DIR... >snapshot.h\n"));
+        flush(err);
+        return 1;
+    }
+
+    s8     *dirs  = new(&perm, s8, argc);
+    i32     ndirs = 0;
+    iz      cap_e = 1<<14;
+    entry_ *es    = new(&perm, entry_, cap_e);
+    i32     len   = 0;
+
+    for (i32 a = first; a < argc; a++) {
+        s8 dir = s8fromcstr((u8 *)argv[a]);
+        while (dir.len>1 && dir.s[dir.len-1]=='/') {
+            dir.len--;
+        }
+
+        u8buf buf = newmembuf(&perm);
+        prints8(&buf, dir);
+        printu8(&buf, 0);
+        s8 pathz = finalize(&buf);
+        iz nfiles = 0;
+        s8node *files = os_listing(perm.ctx, &perm, pathz);
+        for (s8node *n = files; n; n = n->next) {
+            nfiles++;
+        }
+        s8 *names = new(&perm, s8, nfiles);
+        nfiles = 0;
+        for (s8node *n = files; n; n = n->next) {
+            names[nfiles++] = cuttail(n->str, 3);
+        }
+        sort_(names, nfiles);
+
+        i32 mark = len;
+        b32 ok = 1;
+        for (iz i = 0; ok && i < nfiles; i++) {
+            if (s8equals(names[i], S("pkg-config"))) {
+                continue;  // always virtual
+            }
+            if (len == cap_e) {
+                ok = 0;
+                break;
+            }
+            entry_ *e = es + len++;
+            *e = (entry_){0};
+            e->dir = ndirs;
+            ok = load_(e, dir, names[i], define_prefix, err, &perm);
+        }
+
+        if (!ok) {
+            len = mark;
+            prints8(err, S("snapshot: not embedding '"));
+            prints8(err, dir);
+            prints8(err, S("'\n"));
+            flush(err);
+            continue;
+        }
+        dirs[ndirs++] = dir;
+    }
+
+    emit_(out, dirs, ndirs, es, len, define_prefix);
+    flush(out);
+    flush(err);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static os ctx;
+    iz cap = (iz)1<<28;
+    arena perm = {0};
+    perm.beg = malloc((size_t)cap);
+    if (!perm.beg) {
+        return 1;
+    }
+    perm.end = perm.beg + cap;
+    perm.ctx = &ctx;
+
+    (void)uconfig;  // not used by the generator
+    jmp_buf exit;
+    ctx.exit = &exit;
+    if (setjmp(exit)) {
+        return 1;  // out of memory
+    }
+    return snapshot_(argc, argv, perm);
+}
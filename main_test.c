@@ -7,6 +7,7 @@
 #  define __builtin_trap()         *(volatile int *)0 = 0
 #  define __attribute(x)
 #endif
+#define UCONFIG_INSTRUMENT
 #include "src/u-config.c"
 
 #include <setjmp.h>
@@ -56,6 +57,25 @@ static void os_fail(os *ctx)
     longjmp(ctx->exit, 1);
 }
 
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    return 0;  // for deterministic output
+}
+
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    (void)scratch;
+    path.len--;  // trim null terminator
+    s8 *file = insert(&ctx->filesystem, path, 0, &ctx->perm);
+    if (file->s) {
+        data = cuthead(data, header);
+    }
+    s8 r = news8(&ctx->perm, file->len+data.len);
+    s8copy(s8copy(r, *file), data);
+    *file = r;
+}
+
 static filemap os_mapfile(os *ctx, arena *perm, s8 path)
 {
     (void)perm;
@@ -66,7 +86,7 @@ static filemap os_mapfile(os *ctx, arena *perm, s8 path)
 
     filemap r = {0};
 
-    s8 *data = insert(&ctx->filesystem, path, 0);
+    s8 *data = insert(&ctx->filesystem, path, 0, 0);
     if (!data) {
         r.status = filemap_NOTFOUND;
         return r;
@@ -119,26 +139,20 @@ static s8node *s8sort_(s8node *head)
     return rhead;
 }
 
-static s8list os_listing_(s8list r, env *fs, arena *a, s8 path)
-{
-    if (fs) {
-        if (startswith(fs->name, path)) {
-            append(&r, cuthead(fs->name, path.len+1), a);
-        }
-        for (i32 i = 0; i < 4; i++) {
-            r = os_listing_(r, fs->child[i], a, path);
-        }
-    }
-    return r;
-}
-
 static s8node *os_listing(os *ctx, arena *a, s8 path)
 {
     assert(path.s);
     assert(path.len);
     assert(!path.s[path.len-1]);
+    path = cuttail(path, 1);
     s8list r = {0};
-    r = os_listing_(r, ctx->filesystem, a, cuttail(path, 1));
+    env *fs = ctx->filesystem;
+    for (i32 i = 0; fs && i<fs->len; i++) {
+        s8 name = fs->vars[i].name;
+        if (startswith(name, path)) {
+            append(&r, cuthead(name, path.len+1), a);
+        }
+    }
     return s8sort_(r.head);  // sort for determinism
 }
 
@@ -188,6 +202,9 @@ static config newtest_(arena a, s8 name)
 
     os *ctx = new(&a, os, 1);
     ctx->outbuf = news8(&a, 1<<10);
+    ctx->perm.beg = new(&a, byte, 1<<14);  // for os_append()
+    ctx->perm.end = ctx->perm.beg + (1<<14);
+    ctx->perm.ctx = ctx;
 
     config conf = {0};
     conf.delim = ':';
@@ -203,7 +220,7 @@ static config newtest_(arena a, s8 name)
 static void newfile_(config *conf, s8 path, s8 contents)
 {
     os *ctx = conf->perm.ctx;
-    *insert(&ctx->filesystem, path, &conf->perm) = contents;
+    *insert(&ctx->filesystem, path, 0, &conf->perm) = contents;
 }
 
 static void run(config conf, ...)
@@ -635,6 +652,48 @@ static void test_libsorder(arena a)
     EXPECT("-DA -DGL -DB -L/opt/lib -pthread -mwindows -la -lb -lopengl32\n");
 }
 
+static void test_dedup(arena a)
+{
+    // Scenario: two packages repeat paths, libraries, and other flags,
+    //   including system paths and paths with detached arguments
+    // Expect: the first -I/-L wins, the last -l wins, system paths are
+    //   dropped however often they appear, and detached paths are kept
+    config conf = newtest_(a, S("argument de-duplication"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        PCHDR
+        "Cflags: -I/opt/x -DA -I/usr/include -I/opt/y -I /opt/z\n"
+        "Libs: -L/opt/lib -lm -la -L/usr/lib -lm -pthread\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        PCHDR
+        "Cflags: -I/opt/y -DB -I/usr/include -I/opt/x -I /opt/z -DA\n"
+        "Libs: -L/lib -L/opt/b -lb -la -L/opt/lib -pthread -lb\n"
+    ));
+    #define L8 "-l1 -l2 -l3 -l4 -l5 -l6 -l7 -l8 -L/usr/lib "
+    newfile_(&conf, S("/usr/lib/pkgconfig/many.pc"), S(
+        PCHDR
+        "Libs: -lm " L8 L8 L8 L8 L8 L8 L8 L8 "-l1\n"
+    ));
+    #undef L8
+
+    SHOULDPASS {
+        run(conf, S("--cflags"), S("a b"), E);
+    }
+    EXPECT("-I/opt/x -DA -I/opt/y -I /opt/z -DB -I /opt/z\n");
+    SHOULDPASS {
+        run(conf, S("--libs"), S("a b"), E);
+    }
+    EXPECT("-L/opt/lib -lm -pthread -L/opt/b -la -lb\n");
+    SHOULDPASS {
+        run(conf, S("--libs"), S("b a"), E);
+    }
+    EXPECT("-L/opt/b -L/opt/lib -pthread -lb -la -lm\n");
+    SHOULDPASS {
+        run(conf, S("--libs"), S("many"), E);
+    }
+    EXPECT("-lm -l2 -l3 -l4 -l5 -l6 -l7 -l8 -l1\n");
+}
+
 static void test_staticorder(arena a)
 {
     // Scenario: liba depends on libc and libb, libb depends on libc
@@ -660,6 +719,698 @@ static void test_staticorder(arena a)
     EXPECT("-la -lb -lc\n");
 }
 
+static void test_sections(arena a)
+{
+    // Scenario: CMake's FindPkgConfig wants every filtered output class
+    // Expect: each section matches its standalone run, including dedup
+    //   and system path exclusion, from a single resolution
+    config conf = newtest_(a, S("split sections"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        "Name:\n"
+        "Version: 1.2\n"
+        "Description:\n"
+        "Requires: b\n"
+        "Requires.private: c\n"
+        "Cflags: -I/usr/include -I/opt/a -DA -pthread\n"
+        "Libs: -L/usr/lib -L/opt/a -la -pthread -Wl,--as-needed\n"
+        "Libs.private: -lm\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        "Name:\n"
+        "Version: 3\n"
+        "Description:\n"
+        "Cflags: -I/opt/a -DB -pthread\n"
+        "Libs: -L/opt/a -lb -pthread\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/c.pc"), S(
+        "Name:\n"
+        "Version: 4\n"
+        "Description:\n"
+        "Cflags: -DC\n"
+        "Libs: -lc\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--sections"), S("a"), E);
+    }
+    EXPECT(
+        "modversion 1.2\n"
+        "cflags -I/opt/a -DA -pthread -DB -DC\n"
+        "cflags-only-I -I/opt/a\n"
+        "cflags-only-other -DA -pthread -DB -DC\n"
+        "libs -L/opt/a -la -pthread -Wl,--as-needed -lb\n"
+        "libs-only-L -L/opt/a\n"
+        "libs-only-l -la -lb\n"
+        "libs-only-other -pthread -Wl,--as-needed\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--sections"), S("--static"), S("--newlines"),
+                  S("--keep-system-libs"), S("a"), S("c"), E);
+    }
+    EXPECT(
+        "modversion\n1.2\n4\n"
+        "cflags\n-I/opt/a\n-DA\n-pthread\n-DB\n-DC\n"
+        "cflags-only-I\n-I/opt/a\n"
+        "cflags-only-other\n-DA\n-pthread\n-DB\n-DC\n"
+        "libs\n-L/usr/lib\n-L/opt/a\n-la\n-pthread\n-Wl,--as-needed\n"
+            "-lm\n-lb\n-lc\n"
+        "libs-only-L\n-L/usr/lib\n-L/opt/a\n"
+        "libs-only-l\n-la\n-lm\n-lb\n-lc\n"
+        "libs-only-other\n-pthread\n-Wl,--as-needed\n"
+    );
+
+    // Empty sections are still present
+    SHOULDPASS {
+        run(conf, S("--sections"), S("c"), E);
+    }
+    EXPECT(
+        "modversion 4\n"
+        "cflags -DC\n"
+        "cflags-only-I\n"
+        "cflags-only-other -DC\n"
+        "libs -lc\n"
+        "libs-only-L\n"
+        "libs-only-l -lc\n"
+        "libs-only-other\n"
+    );
+}
+
+static void test_json(arena a)
+{
+    config conf = newtest_(a, S("json output"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        "prefix=/opt/a b\n"
+        "Name: A\n"
+        "Version: 1\n"
+        "Description: say \"hi\"\ttab\n"
+        "Requires.private: b\n"
+        "Cflags: -I\"${prefix}/include\" -DA\n"
+        "Libs: -L/usr/lib -la\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        "Name:\n"
+        "Version: 2\n"
+        "Description:\n"
+        "Cflags: -DA -DB\n"
+        "Libs: -lb\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--json"), S("--variable=prefix"), S("a"), E);
+    }
+    EXPECT(
+        "{\n"
+        "  \"packages\": [\n"
+        "    {\n"
+        "      \"name\": \"a\",\n"
+        "      \"path\": \"/usr/lib/pkgconfig/a.pc\",\n"
+        "      \"version\": \"1\",\n"
+        "      \"direct\": true,\n"
+        "      \"public\": true,\n"
+        "      \"fields\": {\n"
+        "        \"Name\": \"A\",\n"
+        "        \"Description\": \"say \\\"hi\\\"\\ttab\",\n"
+        "        \"Version\": \"1\",\n"
+        "        \"Requires.private\": \"b\",\n"
+        "        \"Libs\": \"-L/usr/lib -la\",\n"
+        "        \"Cflags\": \"-I\\\"/opt/a b/include\\\" -DA\"\n"
+        "      },\n"
+        "      \"variables\": {\n"
+        "        \"prefix\": \"/opt/a b\"\n"
+        "      }\n"
+        "    },\n"
+        "    {\n"
+        "      \"name\": \"b\",\n"
+        "      \"path\": \"/usr/lib/pkgconfig/b.pc\",\n"
+        "      \"version\": \"2\",\n"
+        "      \"direct\": false,\n"
+        "      \"public\": false,\n"
+        "      \"fields\": {\n"
+        "        \"Name\": \"\",\n"
+        "        \"Description\": \"\",\n"
+        "        \"Version\": \"2\",\n"
+        "        \"Libs\": \"-lb\",\n"
+        "        \"Cflags\": \"-DA -DB\"\n"
+        "      },\n"
+        "      \"variables\": {}\n"
+        "    }\n"
+        "  ],\n"
+        "  \"cflags\": [\"-I/opt/a b/include\", \"-DA\", \"-DB\"],\n"
+        "  \"libs\": [\"-la\"]\n"
+        "}\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--json"), S("--static"), S("--msvc-syntax"),
+                  S("--libs-only-l"), S("a"), E);
+    }
+    MATCH("  \"libs\": [\"a.lib\", \"b.lib\"]\n}\n");
+
+    // Paths from ${pcfiledir} are encoded internally, and must come out
+    // decoded, as valid UTF-8, in fields and variables too
+    newfile_(&conf, S("/opt/pc dir/c.pc"), S(
+        "prefix=${pcfiledir}/..\n"
+        PCHDR
+        "Cflags: -I${prefix}/include\n"
+    ));
+    SHOULDPASS {
+        config copy = conf;
+        copy.envpath = S("/opt/pc dir");
+        run(copy, S("--json"), S("--variable=prefix"), S("c"), E);
+    }
+    MATCH("        \"Cflags\": \"-I/opt/pc dir/../include\"\n");
+    MATCH("        \"prefix\": \"/opt/pc dir/..\"\n");
+    MATCH("  \"cflags\": [\"-I/opt/pc dir/../include\"],\n");
+}
+
+static void test_graph(arena a)
+{
+    config conf = newtest_(a, S("dependency graph"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        "Name:\n"
+        "Version: 1\n"
+        "Description:\n"
+        "Requires: c\n"
+        "Requires.private: b >= 2\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        "Name:\n"
+        "Version: 2\n"
+        "Description:\n"
+        "Requires: c\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/c.pc"), S(
+        "Name:\n"
+        "Version: 3\n"
+        "Description:\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--print-graph=dot"), S("a"), E);
+    }
+    EXPECT(
+        "digraph \"pkg-config\" {\n"
+        "  \"a\" [label=\"a 1\", peripheries=2]\n"
+        "  \"b\" [label=\"b 2\", style=dashed]\n"
+        "  \"c\" [label=\"c 3\"]\n"
+        "  \"a\" -> \"b\" [style=dashed, label=\">= 2\"]\n"
+        "  \"b\" -> \"c\"\n"
+        "  \"a\" -> \"c\"\n"
+        "}\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--print-graph"), S("json"), S("a = 1"), E);
+    }
+    EXPECT(
+        "{\n"
+        "  \"nodes\": [\n"
+        "    {\"name\": \"a\", \"version\": \"1\", "
+                "\"direct\": true, \"public\": true},\n"
+        "    {\"name\": \"b\", \"version\": \"2\", "
+                "\"direct\": false, \"public\": false},\n"
+        "    {\"name\": \"c\", \"version\": \"3\", "
+                "\"direct\": false, \"public\": true}\n"
+        "  ],\n"
+        "  \"edges\": [\n"
+        "    {\"from\": null, \"to\": \"a\", \"private\": false, "
+                "\"constraint\": {\"op\": \"=\", \"version\": \"1\"}},\n"
+        "    {\"from\": \"a\", \"to\": \"b\", \"private\": true, "
+                "\"constraint\": {\"op\": \">=\", \"version\": \"2\"}},\n"
+        "    {\"from\": \"b\", \"to\": \"c\", \"private\": false, "
+                "\"constraint\": null},\n"
+        "    {\"from\": \"a\", \"to\": \"c\", \"private\": false, "
+                "\"constraint\": null}\n"
+        "  ]\n"
+        "}\n"
+    );
+
+    SHOULDFAIL {
+        run(conf, S("--print-graph=svg"), S("a"), E);
+    }
+}
+
+static void test_emit(arena a)
+{
+    config conf = newtest_(a, S("build system fragments"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/gtk+-3.0.pc"), S(
+        "Name:\n"
+        "Version: 3.24\n"
+        "Description:\n"
+        "Requires.private: 2d\n"
+        "Cflags: -DCOST=$$5 \"-DQ=it's\"\n"
+        "Libs: -lgtk\n"
+        "Libs.private: -lm\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/2d.pc"), S(
+        "Name:\n"
+        "Version: 1\n"
+        "Description:\n"
+        "Cflags: -I/opt/2d\n"
+        "Libs: -l2d\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--emit=make"), S("gtk+-3.0 2d"), E);
+    }
+    EXPECT(
+        "GTK__3_0_CFLAGS = -DCOST=$$5 -DQ=it\\'s -I/opt/2d\n"
+        "GTK__3_0_LIBS = -lgtk\n"
+        "GTK__3_0_VERSION = 3.24\n"
+        "_2D_CFLAGS = -I/opt/2d\n"
+        "_2D_LIBS = -l2d\n"
+        "_2D_VERSION = 1\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--emit"), S("ninja"), S("--static"), S("gtk+-3.0"), E);
+    }
+    EXPECT(
+        "GTK__3_0_CFLAGS = -DCOST=$$5 -DQ=it\\'s -I/opt/2d\n"
+        "GTK__3_0_LIBS = -lgtk -lm -l2d\n"
+        "GTK__3_0_VERSION = 3.24\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--emit=sh"), S("--newlines"), S("gtk+-3.0"), E);
+    }
+    EXPECT(
+        "GTK__3_0_CFLAGS='-DCOST=$5 -DQ=it\\'\\''s -I/opt/2d'\n"
+        "GTK__3_0_LIBS='-lgtk'\n"
+        "GTK__3_0_VERSION='3.24'\n"
+    );
+
+    SHOULDFAIL {
+        run(conf, S("--emit=scons"), S("2d"), E);
+    }
+}
+
+static void test_cmake(arena a)
+{
+    config conf = newtest_(a, S("CMake imported targets"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        "Name:\n"
+        "Version: 1\n"
+        "Description:\n"
+        "Requires: b\n"
+        "Cflags: -I/opt/a -DA \"-DS=a;b\" -I/usr/include\n"
+        "Libs: -L/opt/a -la -Wl,--as-needed\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        "Name:\n"
+        "Version: 2\n"
+        "Description:\n"
+        "Libs: -lb\n"
+    ));
+    // Broken: requires a missing package
+    newfile_(&conf, S("/usr/lib/pkgconfig/broken.pc"), S(
+        "Name:\n"
+        "Version: 3\n"
+        "Description:\n"
+        "Requires: missing\n"
+    ));
+    // Broken: fails to expand, dequote, or parse its requirements
+    newfile_(&conf, S("/usr/lib/pkgconfig/badvar.pc"), S(
+        "Name:\n"
+        "Version: 6\n"
+        "Description:\n"
+        "Libs: -l${nope}\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/badquote.pc"), S(
+        "Name:\n"
+        "Version: 7\n"
+        "Description:\n"
+        "Cflags: -I'/opt/bad quote\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/badspec.pc"), S(
+        "Name:\n"
+        "Version: 8\n"
+        "Description:\n"
+        "Requires: b >=\n"
+    ));
+    // Shadowed by the earlier directory
+    newfile_(&conf, S("/usr/share/pkgconfig/b.pc"), S(
+        "Name:\n"
+        "Version: 4\n"
+        "Description:\n"
+    ));
+    newfile_(&conf, S("/usr/share/pkgconfig/c++.pc"), S(
+        "Name:\n"
+        "Version: 5\n"
+        "Description:\n"
+        "Requires.private: b = 1\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--emit=cmake"), S("--msvc-syntax"), S("a"), E);
+    }
+    EXPECT(
+        "# a 1\n"
+        "if(NOT TARGET PkgConfig::a)\n"
+        "  add_library(PkgConfig::a INTERFACE IMPORTED)\n"
+        "  set_target_properties(PkgConfig::a PROPERTIES\n"
+        "    INTERFACE_INCLUDE_DIRECTORIES \"/opt/a\"\n"
+        "    INTERFACE_COMPILE_OPTIONS \"-DA;-DS=a\\;b\"\n"
+        "    INTERFACE_LINK_DIRECTORIES \"/opt/a\"\n"
+        "    INTERFACE_LINK_LIBRARIES \"a;b\"\n"
+        "    INTERFACE_LINK_OPTIONS \"-Wl,--as-needed\"\n"
+        "  )\n"
+        "endif()\n"
+    );
+
+    // Every package, skipping broken, shadowed, and version conflicts,
+    // while the broken packages still fail on their own
+    SHOULDPASS {
+        run(conf, S("--list-all"), S("--emit=make"), E);
+    }
+    EXPECT(
+        "A_CFLAGS = -I/opt/a -DA -DS=a;b\n"
+        "A_LIBS = -L/opt/a -la -Wl,--as-needed -lb\n"
+        "A_VERSION = 1\n"
+        "B_CFLAGS = \n"
+        "B_LIBS = -lb\n"
+        "B_VERSION = 2\n"
+    );
+    SHOULDFAIL {
+        run(conf, S("--emit=make"), S("badvar"), E);
+    }
+    SHOULDFAIL {
+        run(conf, S("--emit=make"), S("badquote"), E);
+    }
+    SHOULDFAIL {
+        run(conf, S("--emit=make"), S("badspec"), E);
+    }
+}
+
+static void test_proberollback(arena a)
+{
+    // Scenario: b loads c, then fails on x, which is missing from the
+    //   first directory and does not parse in the second
+    // Expect: b is skipped whole, and the packages probed after it load
+    //   and order their flags as if b were never listed
+    config conf = newtest_(a, S("failed probe between loads"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        PCHDR
+        "Requires.private: c\n"
+        "Cflags: -DA\n"
+        "Libs: -la\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        PCHDR
+        "Requires: c x\n"
+        "Cflags: -DB\n"
+        "Libs: -lb\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/c.pc"), S(
+        PCHDR
+        "Cflags: -DC\n"
+        "Libs: -lc\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/d.pc"), S(
+        PCHDR
+        "Requires: a c\n"
+        "Libs: -ld\n"
+    ));
+    newfile_(&conf, S("/usr/share/pkgconfig/x.pc"), S(
+        PCHDR
+        "v=1\n"
+        "v=2\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--list-all"), S("--emit=make"), S("--static"), E);
+    }
+    EXPECT(
+        "A_CFLAGS = -DA -DC\n"
+        "A_LIBS = -la -lc\n"
+        "A_VERSION = \n"
+        "C_CFLAGS = -DC\n"
+        "C_LIBS = -lc\n"
+        "C_VERSION = \n"
+        "D_CFLAGS = -DA -DC\n"
+        "D_LIBS = -ld -la -lc\n"
+        "D_VERSION = \n"
+    );
+
+    SHOULDFAIL {
+        run(conf, S("--exists"), S("b"), E);
+    }
+    SHOULDPASS {
+        run(conf, S("--static"), S("--libs"), S("d"), E);
+    }
+    EXPECT("-ld -la -lc\n");
+
+    // Failed probes, whether missing or unparseable, leave the arena
+    // exactly as they found it, however many directories are searched
+    arena perm = conf.perm;
+    search dirs = {0};
+    dirs.delim = ':';
+    for (i32 i = 0; i < 300; i++) {
+        appendpath(&dirs, S("/opt/empty"), &perm);
+    }
+    appendpath(&dirs, S("/usr/lib/pkgconfig:/usr/share/pkgconfig"), &perm);
+    u8buf *null = newnullout(&perm);
+    arena before = perm;
+    for (i32 i = 0; i < 300; i++) {
+        s8 name = i&1 ? S("missing") : S("x");
+        pcfile pc = findpackage(&dirs, null, name, 0, 1, &perm);
+        if (pc.path.s || perm.beg!=before.beg || perm.end!=before.end) {
+            printf("probe %d of %s: arena grew by %td bytes\n",
+                   (int)i, (char *)name.s,
+                   (before.end-before.beg) - (perm.end-perm.beg));
+            fflush(stdout);
+            __builtin_trap();
+        }
+    }
+}
+
+static void test_variables(arena a)
+{
+    config conf = newtest_(a, S("--variables and --print-variables"));
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        "prefix=/opt\n"
+        "base=${prefix}/a\n"
+        "includedir=${base}/include\n"
+        "libdir=${base}/lib\n"
+        "cost=$$5\n"
+        "Name:\n"
+        "Version: 1\n"
+        "Description:\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--print-variables"), S("a"), E);
+    }
+    EXPECT(
+        "prefix\n"
+        "base\n"
+        "includedir\n"
+        "libdir\n"
+        "cost\n"
+        "pcfiledir\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--variables=libdir,includedir,missing,cost"), S("a"), E);
+    }
+    EXPECT(
+        "libdir=/opt/a/lib\n"
+        "includedir=/opt/a/include\n"
+        "cost=$5\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--variables="), S("a"), E);
+    }
+    EXPECT(
+        "prefix=/opt\n"
+        "base=/opt/a\n"
+        "includedir=/opt/a/include\n"
+        "libdir=/opt/a/lib\n"
+        "cost=$5\n"
+        "pcfiledir=/usr/lib/pkgconfig\n"
+    );
+
+    SHOULDPASS {
+        run(conf, S("--define-variable=prefix=/usr"), S("--variables"),
+            S("libdir"), S("a"), E);
+    }
+    EXPECT("libdir=/usr/a/lib\n");
+}
+
+static void test_stats(arena a)
+{
+    config conf = newtest_(a, S("--stats"));
+    newfile_(&conf, S("/usr/share/pkgconfig/a.pc"), S(
+        "prefix=/opt\n"
+        "Name:\n"
+        "Version: 1\n"
+        "Description:\n"
+        "Requires: b\n"
+        "Cflags: -I${prefix}/include -DA\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        PCHDR
+        "Cflags: -DA\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--stats"), S("--cflags"), S("a"), E);
+    }
+    MATCH("-I/opt/include -DA\n");
+    MATCH("  directories searched: 3\n");
+    MATCH("  opens attempted: 3\n");
+    MATCH("  opens failed: 1\n");
+    MATCH("  files read: 2\n");
+    MATCH("  packages loaded: 2\n");
+    MATCH("  variables expanded: 1\n");
+    MATCH("  tokens deduplicated: 1\n");
+    MATCH("  parse: 0 us, ");
+    MATCH("  output: 0 us, ");
+}
+
+static void test_trace(arena a)
+{
+    config conf = newtest_(a, S("PKG_CONFIG_TRACE"));
+    conf.tracefile = S("/tmp/trace.json\0");
+    conf.pid = 42;
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        PCHDR
+        "Cflags: -DA\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--cflags"), S("a"), E);
+    }
+    SHOULDPASS {
+        run(conf, S("--modversion"), S("a"), E);
+    }
+
+    // Events from both runs append to one array, opened only once
+    s8 trace = lookup(0, conf.perm.ctx->filesystem, S("/tmp/trace.json"));
+    s8 want = S(
+        "[\n"
+        "{\"name\":\"parsepackage\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"package\":\"a\"}},\n"
+        "{\"name\":\"findpackage\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"package\":\"a\"}},\n"
+        "{\"name\":\"expandmerge\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"package\":\"a\"}},\n"
+        "{\"name\":\"appendfield\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"package\":\"a\"}},\n"
+        "{\"name\":\"writeargs\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42},\n"
+        "{\"name\":\"pkg-config\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"command\":\"pkg-config --cflags a\"}},\n"
+    );
+    if (!startswith(trace, want)) {
+        printf("TRACE:  %.*s", (int)trace.len, trace.s);
+        fflush(stdout);
+        __builtin_trap();
+    }
+    trace = cuthead(trace, want.len);
+    if (!startswith(trace, S("{\"name\":\"parsepackage\""))) {
+        __builtin_trap();
+    }
+    s8 last = S("\"command\":\"pkg-config --modversion a\"}},\n");
+    if (!s8equals(taketail(trace, last.len), last)) {
+        __builtin_trap();
+    }
+
+    // A failed run still writes the events recorded before failing. The
+    // last argument loads first, so "a" loads before "missing" fails.
+    conf.tracefile = S("/tmp/fail.json\0");
+    SHOULDFAIL {
+        run(conf, S("--cflags"), S("missing"), S("a"), E);
+    }
+    trace = lookup(0, conf.perm.ctx->filesystem, S("/tmp/fail.json"));
+    want = S(
+        "[\n"
+        "{\"name\":\"parsepackage\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"package\":\"a\"}},\n"
+        "{\"name\":\"findpackage\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"package\":\"a\"}},\n"
+        "{\"name\":\"expandmerge\",\"cat\":\"u-config\",\"ph\":\"X\","
+        "\"ts\":0,\"dur\":0,\"pid\":42,\"tid\":42,"
+        "\"args\":{\"package\":\"a\"}},\n"
+    );
+    if (!s8equals(trace, want)) {
+        printf("TRACE:  %.*s", (int)trace.len, trace.s);
+        fflush(stdout);
+        __builtin_trap();
+    }
+}
+
+static void test_log(arena a)
+{
+    config conf = newtest_(a, S("PKG_CONFIG_LOG"));
+    conf.logfile = S("/tmp/pkg-config.log\0");
+    newfile_(&conf, S("/usr/lib/pkgconfig/a.pc"), S(
+        PCHDR
+        "Cflags: -DA\n"
+        "Requires: b\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/b.pc"), S(
+        PCHDR
+        "Cflags: -DB\n"
+    ));
+
+    SHOULDPASS {
+        run(conf, S("--cflags"), S("a"), E);
+    }
+    SHOULDPASS {
+        run(conf, S("--cflags"), S("a"), E);
+    }
+    SHOULDFAIL {
+        run(conf, S("--libs"), S("c\tx"), E);
+    }
+
+    s8 log = lookup(0, conf.perm.ctx->filesystem, S("/tmp/pkg-config.log"));
+    s8 want = S(
+        "0\t0\t8\t2\t2\t0bd03211\ta,b\t--cflags a\n"
+        "0\t0\t8\t2\t2\t0bd03211\ta,b\t--cflags a\n"
+        "0\t1\t0\t2\t0\t0bd03211\t\t--libs c x\n"
+    );
+    if (!s8equals(log, want)) {
+        printf("LOG:  %.*s", (int)log.len, log.s);
+        fflush(stdout);
+        __builtin_trap();
+    }
+
+    // Summaries are not themselves logged
+    SHOULDPASS {
+        run(conf, S("--log-summary"), E);
+    }
+    EXPECT(
+        "pkg-config: log summary\n"
+        "  invocations: 3\n"
+        "  failures: 1\n"
+        "  distinct queries: 2\n"
+        "  repeated queries: 1\n"
+        "  total time: 0 us\n"
+        "  repeated time: 0 us\n"
+        "  files read: 4\n"
+        "  bytes output: 16\n"
+        "most repeated (runs, total us, arguments):\n"
+        "  2\t0\t--cflags a\n"
+        "slowest (us, status, arguments):\n"
+        "  0\t0\t--cflags a\n"
+        "  0\t0\t--cflags a\n"
+        "  0\t1\t--libs c x\n"
+    );
+    SHOULDFAIL {
+        run(conf, S("--log-summary=/tmp/missing.log"), E);
+    }
+}
+
 static void test_windows(arena a)
 {
     // Tests the ';' delimiter, that the prefix is overridden, and that
@@ -930,13 +1681,23 @@ static void printi32_(u8buf *out, i32 x)
 
 static void test_manyvars(arena a)
 {
-    // Stresses the hash-trie-backed package environment
+    // Stresses the hash-table-backed package environment
     config conf = newtest_(a, S("many variables"));
     newfile_(&conf, S("manyvars.pc"), S(""));  // allocate empty file
+
+    // A table created on first insertion is hashed under the given seed
+    env *e = 0;
+    *insert(&e, S("x"), 0x9e3779b9u, &conf.perm) = S("1");
+    if (e->seed != 0x9e3779b9u) {
+        printf("insert: new environment ignores seed 0x%x\n", (unsigned)e->seed);
+        fflush(stdout);
+        __builtin_trap();
+    }
     i32 nvars = 10000;
 
     for (i32 i = 0; i < nvars; i += 197) {
         config temp = conf;
+        temp.seed = (u32)i * 0x9e3779b9u;  // also perturb the hash seed
         u8 prefix = 'a' + (u8)(i%26);
 
         // Write a fresh .pc file into the virtual "manyvars.pc" with a
@@ -967,6 +1728,119 @@ static void test_manyvars(arena a)
     }
 }
 
+static void test_deepchain(arena a)
+{
+    config conf = newtest_(a, S("deep dependency chain"));
+
+    // Alternate public and private requires down a long chain
+    i32 depth = 1000;
+    for (i32 i = 0; i < depth; i++) {
+        u8buf mem = newmembuf(&conf.perm);
+        prints8(&mem, S("/usr/lib/pkgconfig/d"));
+        printi32_(&mem, i);
+        prints8(&mem, S(".pc"));
+        s8 path = finalize(&mem);
+
+        mem = newmembuf(&conf.perm);
+        prints8(&mem, S(PCHDR));
+        if (i < depth-1) {
+            prints8(&mem, i%2 ? S("Requires.private: d") : S("Requires: d"));
+            printi32_(&mem, i+1);
+            printu8(&mem, '\n');
+        } else {
+            prints8(&mem, S("Cflags: -Ddeep\n"));
+        }
+        newfile_(&conf, path, finalize(&mem));
+    }
+
+    SHOULDPASS {
+        run(conf, S("--static"), S("--cflags"), S("d0"), E);
+    }
+    EXPECT("-Ddeep\n");
+
+    SHOULDPASS {
+        run(conf, S("--maximum-traverse-depth=999"),
+            S("--static"), S("--cflags"), S("d0"), E);
+    }
+    EXPECT("\n");
+
+    SHOULDPASS {
+        run(conf, S("--maximum-traverse-depth=1000"),
+            S("--static"), S("--cflags"), S("d0"), E);
+    }
+    EXPECT("-Ddeep\n");
+}
+
+static void test_snapshot(arena a)
+{
+    config conf = newtest_(a, S("embedded snapshot"));
+
+    // Covered directories are never read, so these must not be seen
+    newfile_(&conf, S("/usr/lib/pkgconfig/snap.pc"), S(
+        PCHDR
+        "Cflags: -Ddecoy\n"
+    ));
+    newfile_(&conf, S("/usr/lib/pkgconfig/ghost.pc"), S(PCHDR));
+    newfile_(&conf, S("/usr/share/pkgconfig/next.pc"), S(
+        PCHDR
+        "Cflags: -Dnext\n"
+    ));
+
+    // Deliberately disagree with the pre-parsed fields in order to tell
+    // which was used: -Draw when expanded, -Dexpanded when pre-expanded.
+    static s8 dirs[] = {s8("/usr/lib/pkgconfig")};
+    static s8 vars[] = {s8("x"), s8("raw")};
+    static snapshotpkg pkgs[] = {{
+        s8("snap"), s8("/usr/lib/pkgconfig/snap.pc"), vars, 1, 0,
+        {
+            s8("snap"), s8(""), {0}, s8("1.0"),
+            {0}, {0}, {0}, {0}, {0}, s8("-D${x}"), {0},
+        },
+        (u8 *)"snap1.0-Dexpanded",
+        {4, 4, 4, 7, 7, 7, 7, 7, 7, 17, 17},
+        0
+    }};
+    pkgs[0].hash = s8hash(pkgs[0].realname, 0);
+    snapshot saved = embedded;
+    embedded = (snapshot){dirs, countof(dirs), pkgs, countof(pkgs), 0};
+
+    SHOULDPASS {
+        run(conf, S("--cflags"), S("snap"), E);
+    }
+    EXPECT("-Dexpanded\n");
+
+    SHOULDPASS {
+        run(conf, S("--define-variable=y=z"), S("--cflags"), S("snap"), E);
+    }
+    EXPECT("-Draw\n");
+
+    SHOULDPASS {
+        run(conf, S("--define-prefix"), S("--cflags"), S("snap"), E);
+    }
+    EXPECT("-Draw\n");
+
+    SHOULDPASS {
+        run(conf, S("--variable=x"), S("snap"), E);
+    }
+    EXPECT("raw\n");
+
+    SHOULDPASS {
+        run(conf, S("--cflags"), S("next"), E);
+    }
+    EXPECT("-Dnext\n");
+
+    SHOULDFAIL {
+        run(conf, S("ghost"), E);
+    }
+
+    SHOULDPASS {
+        run(conf, S("--list-package-names"), E);
+    }
+    EXPECT("snap\nnext\n");
+
+    embedded = saved;
+}
+
 static void test_lol(arena a)
 {
     config conf = newtest_(a, S("a billion laughs"));
@@ -991,6 +1865,61 @@ static void test_lol(arena a)
     MATCH("out of memory");
 }
 
+// Search for a collision-free seed and print replacement tables.
+static void regenerate_(const keywords *k)
+{
+    u8  slots[1<<8];
+    i32 nslots = 1 << k->exp;
+    assert(nslots <= countof(slots));
+    for (u32 seed = 1;; seed++) {
+        for (i32 i = 0; i < nslots; i++) {
+            slots[i] = 0;
+        }
+        i32 i = 0;
+        for (; i < k->len; i++) {
+            u32 h = s8hash(k->keys[i].name, seed) >> (32 - k->exp);
+            if (slots[h]) {
+                break;
+            }
+            slots[h] = (u8)(i + 1);
+        }
+        if (i == k->len) {
+            printf("seed 0x%x, slots:", (unsigned)seed);
+            for (i = 0; i < nslots; i++) {
+                printf("%s%d,", i%16 ? " " : "\n    ", slots[i]);
+            }
+            printf("\n");
+            fflush(stdout);
+            return;
+        }
+    }
+}
+
+static void checkkeywords_(const keywords *k, i32 missing)
+{
+    for (i32 i = 0; i < k->len; i++) {
+        if (keywordid(k, k->keys[i].name, missing) != k->keys[i].id) {
+            printf("perfect hash: no match for \"%.*s\"\n",
+                   (int)k->keys[i].name.len, k->keys[i].name.s);
+            regenerate_(k);
+            __builtin_trap();
+        }
+    }
+
+    // Near misses must not match
+    assert(keywordid(k, S(""), missing) == missing);
+    assert(keywordid(k, S("-"), missing) == missing);
+    assert(keywordid(k, S("Libs.privat"), missing) == missing);
+    assert(keywordid(k, S("-cflag"), missing) == missing);
+}
+
+static void test_perfecthash(void)
+{
+    // Keyword tables must be regenerated whenever a keyword is added
+    checkkeywords_(&fieldtable, -1);
+    checkkeywords_(&optiontable, opt_UNKNOWN);
+}
+
 static arena newarena_(iz cap)
 {
     arena arena = {0};
@@ -1006,6 +1935,7 @@ int main(void)
 {
     arena a = newarena_(1<<21);
 
+    test_perfecthash();  // first, since everything depends on it
     test_noargs(a);
     test_dashdash(a);
     test_modversion(a);
@@ -1018,12 +1948,25 @@ int main(void)
     test_revealed_transitive(a);
     test_syspaths(a);
     test_libsorder(a);
+    test_dedup(a);
     test_staticorder(a);
+    test_sections(a);
+    test_json(a);
+    test_graph(a);
+    test_emit(a);
+    test_cmake(a);
+    test_proberollback(a);
+    test_variables(a);
+    test_stats(a);
+    test_trace(a);
+    test_log(a);
     test_windows(a);
     test_parens(a);
     test_listing(a);
     test_error_messages(a);
     test_manyvars(a);
+    test_deepchain(a);
+    test_snapshot(a);
     test_lol(a);
 
     puts("all tests pass");
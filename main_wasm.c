@@ -1,17 +1,17 @@
 #include "src/u-config.c"
 
-typedef long long   i64;
-
 enum {
-    WASI_FD_READ        = 1 << 1,
-    WASI_FD_READDIR     = 1 << 14,
-    WASI_O_DIRECTORY    = 1 << 1,
+    WASI_CLOCK_MONOTONIC = 1,
+    WASI_FD_READ         = 1 << 1,
+    WASI_FD_READDIR      = 1 << 14,
+    WASI_O_DIRECTORY     = 1 << 1,
 };
 
 #define WASI(s) \
   __attribute((import_module("wasi_snapshot_preview1"), import_name(s)))
 WASI("args_get")            i32  args_get(u8 **, u8 *);
 WASI("args_sizes_get")      i32  args_sizes_get(i32 *, iz *);
+WASI("clock_time_get")      i32  clock_time_get(i32, i64, i64 *);
 WASI("environ_get")         i32  environ_get(u8 **, u8 *);
 WASI("environ_sizes_get")   i32  environ_sizes_get(i32 *, iz *);
 WASI("fd_close")            i32  fd_close(i32);
@@ -206,6 +206,24 @@ static s8node *os_listing(os *ctx, arena *a, s8 path)
     return r.head;
 }
 
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    i64 ns = 0;
+    clock_time_get(WASI_CLOCK_MONOTONIC, 1000, &ns);
+    return ns / 1000;
+}
+
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    // Neither $PKG_CONFIG_TRACE nor $PKG_CONFIG_LOG is ever set
+    (void)ctx;
+    (void)scratch;
+    (void)path;
+    (void)data;
+    (void)header;
+}
+
 static void os_write(os *ctx, i32 fd, s8 data)
 {
     if (fd_write(fd, &data, 1, &data.len)) {
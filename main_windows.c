@@ -4,6 +4,7 @@
 #include "src/u-config.c"
 #include "src/miniwin32.h"
 #include "src/cmdline.c"
+#include "src/memory.c"
 
 #ifndef PKG_CONFIG_PREFIX
 #  define PKG_CONFIG_PREFIX
@@ -312,6 +313,15 @@ static config *newconfig_(os *ctx)
     return conf;
 }
 
+// Seed for hash tables keyed by untrusted input: mix the stack address
+// (ASLR), the performance counter, and the process ID.
+static u32 newseed_(void *stack)
+{
+    i64 mix[3] = {(i64)(uptr)stack, 0, GetCurrentProcessId()};
+    QueryPerformanceCounter(mix+1);
+    return s8hash((s8){(u8 *)mix, sizeof(mix)}, 0);
+}
+
 __attribute((force_align_arg_pointer))
 void mainCRTStartup(void)
 {
@@ -324,6 +334,7 @@ void mainCRTStartup(void)
 
     config *conf = newconfig_(ctx);
     conf->delim = ';';
+    conf->seed = newseed_(ctx);
     conf->define_prefix = 1;
     arena *perm = &conf->perm;
 
@@ -348,6 +359,15 @@ void mainCRTStartup(void)
     conf->sys_libpath  = conf->pc_syslibpath;
     conf->print_sysinc = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_CFLAGS");
     conf->print_syslib = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_LIBS");
+    conf->tracefile    = fromenv_(perm, L"PKG_CONFIG_TRACE");
+    if (conf->tracefile.s) {
+        conf->tracefile = append2_(perm, conf->tracefile, S("\0"));
+        conf->pid = GetCurrentProcessId();
+    }
+    conf->logfile      = fromenv_(perm, L"PKG_CONFIG_LOG");
+    if (conf->logfile.s) {
+        conf->logfile = append2_(perm, conf->logfile, S("\0"));
+    }
 
     // Reduce backslash occurrences in outputs
     normalize_(conf->envpath);
@@ -450,6 +470,50 @@ static void os_fail(os *ctx)
     assert(0);
 }
 
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    assert(ctx);
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    s16 wpath = towide_(scratch, path);
+    i32 handle = CreateFileW(
+        wpath.s,
+        FILE_APPEND_DATA,
+        FILE_SHARE_ALL,
+        0,
+        CREATE_NEW,
+        FILE_ATTRIBUTE_NORMAL,
+        0
+    );
+    if (handle == INVALID_HANDLE_VALUE) {
+        handle = CreateFileW(
+            wpath.s,
+            FILE_APPEND_DATA,
+            FILE_SHARE_ALL,
+            0,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            0
+        );
+        data = cuthead(data, header);
+    }
+    if (handle != INVALID_HANDLE_VALUE) {
+        i32 dummy;
+        WriteFile(handle, data.s, truncsize(data.len), &dummy, 0);
+        CloseHandle(handle);
+    }
+}
+
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    i64 freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (i64)((double)count * 1e6 / (double)freq);  // no 64-bit div
+}
+
 typedef struct {
     c16  buf[1<<8];
     iptr handle;
@@ -21,13 +21,21 @@
 
 // Arch-specific definitions, defined by the includer. Also requires
 // macro definitions for SYS_read, SYS_write, SYS_openat, SYS_close,
-// SYS_exit. Arch-specific _start calls arch-agnostic entrypoint() with
-// the process entry stack pointer.
+// SYS_exit, SYS_clock_gettime (with 64-bit time), and SYS_getpid.
+// Arch-specific _start calls arch-agnostic entrypoint() with the process
+// entry stack pointer.
 static long syscall1(long, long);
 static long syscall3(long, long, long, long);
+static long syscall4(long, long, long, long, long);
 
 enum {
-    AT_FDCWD    = -100,
+    AT_FDCWD        = -100,
+    AT_RANDOM       = 25,
+    CLOCK_MONOTONIC = 1,
+    O_WRONLY        = 01,
+    O_CREAT         = 0100,
+    O_EXCL          = 0200,
+    O_APPEND        = 02000,
 };
 
 static void os_fail(os *ctx)
@@ -37,6 +45,34 @@ static void os_fail(os *ctx)
     __builtin_unreachable();
 }
 
+static i64 os_now(os *ctx)
+{
+    (void)ctx;
+    struct {
+        i64 sec;
+        i64 nsec;
+    } ts = {0};
+    syscall3(SYS_clock_gettime, CLOCK_MONOTONIC, (long)&ts, 0);
+    return ts.sec*1000000 + (long)ts.nsec/1000;
+}
+
+static void os_append(os *ctx, arena *scratch, s8 path, s8 data, iz header)
+{
+    (void)ctx;
+    (void)scratch;
+    assert(!path.s[path.len-1]);
+    long flags = O_WRONLY | O_APPEND | O_CREAT;
+    long fd = syscall4(SYS_openat, AT_FDCWD, (long)path.s, flags|O_EXCL, 0666);
+    if (fd < 0) {
+        fd = syscall4(SYS_openat, AT_FDCWD, (long)path.s, flags, 0666);
+        data = cuthead(data, header);
+    }
+    if (fd >= 0) {
+        syscall3(SYS_write, fd, (long)data.s, data.len);
+        syscall1(SYS_close, fd);
+    }
+}
+
 static void os_write(os *ctx, i32 fd, s8 s)
 {
     (void)ctx;
@@ -174,7 +210,8 @@ static i32 os_main(i32 argc, u8 **argv, u8 **envp)
     conf->sys_incpath = S(PKG_CONFIG_SYSTEM_INCLUDE_PATH);
     conf->sys_libpath = S(PKG_CONFIG_SYSTEM_LIBRARY_PATH);
 
-    for (u8 **v = envp; *v; v++) {
+    u8 **v = envp;
+    for (; *v; v++) {
         cut c = s8cut(s8fromcstr(*v), '=');
         s8 name = c.head;
         s8 value = c.tail;
@@ -193,6 +230,23 @@ static i32 os_main(i32 argc, u8 **argv, u8 **envp)
             conf->print_sysinc = value;
         } else if (s8equals(name, S("PKG_CONFIG_ALLOW_SYSTEM_LIBS"))) {
             conf->print_syslib = value;
+        } else if (s8equals(name, S("PKG_CONFIG_TRACE"))) {
+            conf->tracefile = value;
+            conf->tracefile.len++;  // include terminator
+            conf->pid = (i32)syscall1(SYS_getpid, 0);
+        } else if (s8equals(name, S("PKG_CONFIG_LOG"))) {
+            conf->logfile = value;
+            conf->logfile.len++;  // include terminator
+        }
+    }
+
+    // The auxiliary vector follows the environment, and the kernel
+    // places 16 random bytes behind AT_RANDOM for seeding.
+    for (long *auxv = (long *)(v + 1); auxv[0]; auxv += 2) {
+        if (auxv[0] == AT_RANDOM) {
+            u8 *r = (u8 *)auxv[1];
+            conf->seed = (u32)r[0]     | (u32)r[1]<<8 |
+                         (u32)r[2]<<16 | (u32)r[3]<<24;
         }
     }
 
@@ -1,8 +1,59 @@
+// Memory kernels for the libc-free builds. The compiler may emit calls
+// to these, and the core routes bulk copies and fills through them.
+// This is free and unencumbered software released into the public domain.
+#ifdef __GNUC__  // otherwise the toolchain runtime supplies these
+
+// Define MEMORY_GENERIC to use the portable kernels on x86, for testing.
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(MEMORY_GENERIC)
+// Fast-string microcode (ERMSB) makes these competitive with unrolled
+// vector loops at the sizes u-config handles, in a few bytes of code.
+
+__attribute((section(".text.memcpy")))
+void *memcpy(void *restrict dst, void *restrict src, size_t n)
+{
+    void *r = dst;
+    asm volatile (
+        "rep movsb"
+        : "+D"(dst), "+S"(src), "+c"(n)
+        :
+        : "memory"
+    );
+    return r;
+}
+
+__attribute((section(".text.memset")))
+void *memset(void *restrict dst, int c, size_t n)
+{
+    void *r = dst;
+    asm volatile (
+        "rep stosb"
+        : "+D"(dst), "+c"(n)
+        : "a"(c)
+        : "memory"
+    );
+    return r;
+}
+
+#else
+// Word-wide loops, byte loops at the edges. Sources are only read by the
+// word when co-aligned with the destination, since strict-alignment
+// targets (riscv64) trap or emulate misaligned loads.
+
+typedef size_t __attribute((may_alias)) word_;
+
 __attribute((section(".text.memcpy")))
 void *memcpy(void *restrict dst, void *restrict src, size_t n)
 {
-    u8 *s = src;
     u8 *d = dst;
+    u8 *s = src;
+    size_t w = sizeof(word_);
+    if (!(((size_t)d ^ (size_t)s) & (w - 1))) {
+        for (; n && ((size_t)d & (w - 1)); n--) *d++ = *s++;
+        for (; n >= w; n -= w, d += w, s += w) {
+            asm ("" : "+r"(d));  // keep this loop from becoming memcpy()
+            *(word_ *)d = *(word_ *)s;
+        }
+    }
     for (; n; n--) *d++ = *s++;
     return dst;
 }
@@ -11,6 +62,16 @@ __attribute((section(".text.memset")))
 void *memset(void *restrict dst, int c, size_t n)
 {
     u8 *d = dst;
+    size_t w = sizeof(word_);
+    word_ fill = (u8)c * ((size_t)-1 / 0xff);  // byte broadcast
+    for (; n && ((size_t)d & (w - 1)); n--) *d++ = (u8)c;
+    for (; n >= w; n -= w, d += w) {
+        asm ("" : "+r"(d));  // keep this loop from becoming memset()
+        *(word_ *)d = fill;
+    }
     for (; n; n--) *d++ = (u8)c;
     return dst;
 }
+#endif
+
+#endif  // __GNUC__
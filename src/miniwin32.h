@@ -7,6 +7,10 @@ typedef unsigned short  char16_t;
 typedef char16_t        c16;
 
 enum {
+    CREATE_NEW = 1,
+
+    FILE_APPEND_DATA = 4,
+
     FILE_ATTRIBUTE_NORMAL = 0x80,
 
     FILE_SHARE_ALL = 7,
@@ -45,9 +49,12 @@ W32(iptr)   FindFirstFileW(c16 *, finddata *);
 W32(b32)    FindNextFileW(iptr, finddata *);
 W32(c16 *)  GetCommandLineW(void);
 W32(b32)    GetConsoleMode(iptr, i32 *);
+W32(i32)    GetCurrentProcessId(void);
 W32(i32)    GetEnvironmentVariableW(c16 *, c16 *, i32);
 W32(i32)    GetModuleFileNameW(iptr, c16 *, i32);
 W32(iptr)   GetStdHandle(i32);
+W32(b32)    QueryPerformanceCounter(i64 *);
+W32(b32)    QueryPerformanceFrequency(i64 *);
 W32(b32)    ReadFile(iptr, u8 *, i32, i32 *, uptr);
 W32(byte *) VirtualAlloc(uptr, iz, i32, i32);
 W32(b32)    WriteConsoleW(iptr, c16 *, i32, i32 *, uptr);
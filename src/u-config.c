@@ -4,19 +4,78 @@
 #include <stddef.h>
 #define VERSION "0.34.0"
 
-typedef unsigned char    u8;
-typedef   signed int     b32;
-typedef   signed int     i32;
-typedef unsigned int     u32;
-typedef ptrdiff_t        iz;
-typedef          char    byte;
+typedef unsigned char      u8;
+typedef   signed int       b32;
+typedef   signed int       i32;
+typedef unsigned int       u32;
+typedef   signed long long i64;
+typedef ptrdiff_t          iz;
+typedef          char      byte;
 
 #define assert(c)     while (!(c)) __builtin_unreachable()
 #define countof(a)    (iz)(sizeof(a) / sizeof(*(a)))
-#define new(a, t, n)  (t *)alloc(a, sizeof(t), n)
+#ifdef UCONFIG_MEMPROF
+#  define MEMSTR_(x)    #x
+#  define MEMSTR(x)     MEMSTR_(x)
+#  define MEMSITE(t)    __FILE__ ":" MEMSTR(__LINE__) " " t
+#  define new(a, t, n)  (memsite(MEMSITE(#t)), (t *)alloc(a, sizeof(t), n))
+#else
+#  define new(a, t, n)  (t *)alloc(a, sizeof(t), n)
+#endif
 #define s8(s)         {(u8 *)s, countof(s)-1}
 #define S(s)          (s8)s8(s)
 
+// Userspace statically-defined tracing (USDT) probes for perf, bpftrace,
+// and SystemTap, in the sys/sdt.h note format, but with no dependency on
+// it. A probe site is a nop plus an ELF note holding its address and the
+// locations of its arguments, all passed as longs. Tracers patch the nop
+// only while attached, so an idle probe costs about nothing, and they
+// are present in default builds so that production binaries can be
+// traced as they are. Define UCONFIG_NO_USDT to omit them.
+#if defined(__GNUC__) && defined(__ELF__) && !defined(UCONFIG_NO_USDT)
+#  if __SIZEOF_POINTER__ == 8
+#    define USDT_ADDR ".8byte "
+#  else
+#    define USDT_ADDR ".4byte "
+#  endif
+#  define USDT(name, args) \
+     "990: nop\n" \
+     ".pushsection .note.stapsdt,\"\",\"note\"\n" \
+     ".balign 4\n" \
+     ".4byte 992f-991f, 994f-993f, 3\n" \
+     "991: .asciz \"stapsdt\"\n" \
+     "992: .balign 4\n" \
+     "993: " USDT_ADDR "990b\n" \
+     USDT_ADDR "_.stapsdt.base\n" \
+     USDT_ADDR "0\n" \
+     ".asciz \"uconfig\"\n" \
+     ".asciz \"" #name "\"\n" \
+     ".asciz \"" args "\"\n" \
+     "994: .balign 4\n" \
+     ".popsection\n" \
+     ".ifndef _.stapsdt.base\n" \
+     ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+     ".weak _.stapsdt.base\n" \
+     ".hidden _.stapsdt.base\n" \
+     "_.stapsdt.base: .space 1\n" \
+     ".size _.stapsdt.base, 1\n" \
+     ".popsection\n" \
+     ".endif\n"
+#  define usdt1(name, a) \
+     asm volatile ( \
+         USDT(name, "%n0@%1") \
+         :: "n"(sizeof(long)), "nor"((long)(a)) \
+     )
+#  define usdt2(name, a, b) \
+     asm volatile ( \
+         USDT(name, "%n0@%1 %n0@%2") \
+         :: "n"(sizeof(long)), "nor"((long)(a)), "nor"((long)(b)) \
+     )
+#else
+#  define usdt1(name, a)     (void)(a)
+#  define usdt2(name, a, b)  (void)(a), (void)(b)
+#endif
+
 typedef struct os os;
 
 typedef struct {
@@ -50,6 +109,10 @@ typedef struct {
     s8    sys_libpath;   // $PKG_CONFIG_SYSTEM_LIBRARY_PATH or default
     s8    print_sysinc;  // $PKG_CONFIG_ALLOW_SYSTEM_CFLAGS or empty
     s8    print_syslib;  // $PKG_CONFIG_ALLOW_SYSTEM_LIBS or empty
+    s8    tracefile;     // $PKG_CONFIG_TRACE or null, with terminator
+    s8    logfile;       // $PKG_CONFIG_LOG or null, with terminator
+    i32   pid;           // process ID for trace events
+    u32   seed;          // hash table seed, zero for a fixed seed
     b32   define_prefix;
     b32   haslisting;
     u8    delim;
@@ -85,14 +148,138 @@ static void os_write(os *, i32 fd, s8);
 // Immediately exit the program with a non-zero status.
 static void os_fail(os *) __attribute((noreturn));
 
+// Append data to a file, creating it if necessary, in a single write so
+// that concurrent processes interleave only whole appends. The first
+// "header" bytes of data are written only when this call creates the
+// file. The path includes a null terminator. Errors are ignored.
+static void os_append(os *, arena *, s8 path, s8 data, iz header)
+    __attribute((unused));  // only by UCONFIG_INSTRUMENT
+
+// Monotonic clock in microseconds, only consulted when measuring. May
+// return zero where the platform has no clock.
+static i64 os_now(os *) __attribute((unused));
+
 
 // Application
 
+#ifdef UCONFIG_MEMPROF
+static void memreport(os *);
+#endif
+
+static void fail(os *) __attribute((noreturn));
+
 static void oom(os *ctx)
 {
     os_write(ctx, 2, S("pkg-config: out of memory\n"));
-    os_fail(ctx);
+    #ifdef UCONFIG_MEMPROF
+    memreport(ctx);
+    #endif
+    fail(ctx);
+}
+
+enum { phase_PARSE, phase_PROCESS, phase_OUTPUT, phase_COUNT };
+
+// Instrumentation: --stats, --log-summary, $PKG_CONFIG_TRACE, and
+// $PKG_CONFIG_LOG. Together they would add about a quarter to the
+// binary, so they are compiled in only when UCONFIG_INSTRUMENT is
+// defined, and otherwise their hooks compile to nothing. USDT probes,
+// above, are independent of this.
+#ifdef UCONFIG_INSTRUMENT
+
+// Resolution cost counters for --stats, reset by each uconfig() call.
+// The counters are always kept, but the clock and arena are only read
+// when enabled. Arena peaks are measured from the arena in use on entry
+// to a phase, so each phase is charged only for its own allocations.
+typedef struct {
+    b32 enabled;
+    i32 phase;
+    i64 mark;                // clock at the last phase switch
+    i64 time[phase_COUNT];   // microseconds
+    iz  peak[phase_COUNT];   // arena high-water mark, bytes
+    iz  entry;               // arena space left on entering this phase
+    iz  floor;               // least arena space left this phase
+    i32 dirs;
+    i32 opens;
+    i32 openfails;
+    i32 files;
+    i64 bytes;
+    i32 packages;
+    i32 expansions;
+    i32 dedups;
+    i64 written;  // bytes to standard output, for $PKG_CONFIG_LOG
+} stats;
+
+static stats counters;
+
+#  define tally(field, n)  (counters.field += (n))
+
+// Switch --stats accounting to a new phase, returning the old phase.
+static i32 enterphase(arena *a, i32 phase)
+{
+    i32 prev = counters.phase;
+    if (counters.enabled) {
+        i64 now = os_now(a->ctx);
+        counters.time[prev] += now - counters.mark;
+        counters.mark = now;
+        iz peak = counters.entry - counters.floor;
+        if (peak > counters.peak[prev]) {
+            counters.peak[prev] = peak;
+        }
+        counters.entry = counters.floor = a->end - a->beg;
+    }
+    counters.phase = phase;
+    return prev;
+}
+#else
+#  define tally(field, n)  (void)(n)
+
+static i32 enterphase(arena *a, i32 phase)
+{
+    (void)a;
+    return phase;
+}
+#endif
+
+#ifdef UCONFIG_MEMPROF
+// Allocation-site memory profile: bytes and counts per call site, as
+// labeled by the hooked new(), news8(), and finalize() macros. Reported
+// at exit, and also on arena exhaustion, naming the failing site.
+typedef struct {
+    char *site;
+    iz    bytes;
+    iz    count;
+} memrecord;
+
+typedef struct {
+    memrecord sites[1<<8];
+    char     *pending;  // site of the allocation in progress
+} memprofile;
+
+static memprofile memprof;
+
+static void memsite(char *site)
+{
+    memprof.pending = site;
+}
+
+static void memcharge(iz bytes)
+{
+    char *site = memprof.pending ? memprof.pending : "(unattributed)";
+    memprof.pending = 0;
+    u32 mask = countof(memprof.sites) - 1;
+    u32 i = (u32)((size_t)site >> 3) * 0x9e3779b9u >> 24;
+    for (u32 n = 0; n < mask; n++, i = (i + 1) & mask) {
+        memrecord *r = memprof.sites + i;
+        if (!r->site || r->site==site) {
+            r->site = site;
+            r->bytes += bytes;
+            r->count++;
+            return;
+        }
+    }
 }
+#endif
+
 
 static b32 digit(u8 c)
 {
@@ -108,21 +295,35 @@ static b32 whitespace(u8 c)
     return 0;
 }
 
+// Bulk fills and copies go through the platform's memset and memcpy
+// where the compiler can reach them: libc, src/memory.c for the libc-free
+// builds, or bulk memory instructions on wasm.
 static byte *fillbytes(byte *dst, byte c, iz len)
 {
+    assert(len >= 0);
+    #ifdef __GNUC__
+    return len ? __builtin_memset(dst, c, (size_t)len) : dst;
+    #else
     byte *r = dst;
     for (; len; len--) {
         *dst++ = c;
     }
     return r;
+    #endif
 }
 
 static void u8copy(u8 *dst, u8 *src, iz n)
 {
     assert(n >= 0);
+    #ifdef __GNUC__
+    if (n) {  // null pointers are allowed when empty
+        __builtin_memcpy(dst, src, (size_t)n);
+    }
+    #else
     for (; n; n--) {
         *dst++ = *src++;
     }
+    #endif
 }
 
 static i32 u8compare(u8 *a, u8 *b, iz n)
@@ -139,7 +340,8 @@ static b32 pathsep(u8 c)
     return c=='/' || c=='\\';
 }
 
-static byte *alloc(arena *a, iz size, iz count)
+// Allocate without zeroing, for buffers the caller fills immediately.
+static byte *allocraw(arena *a, iz size, iz count)
 {
     assert(size > 0);
     assert(count >= 0);
@@ -149,13 +351,28 @@ static byte *alloc(arena *a, iz size, iz count)
         oom(a->ctx);
     }
     iz total = size * count;
-    return fillbytes(a->end -= total + alignment, 0, total);
+    a->end -= total + alignment;
+    #ifdef UCONFIG_INSTRUMENT
+    if (a->end - a->beg < counters.floor) {
+        counters.floor = a->end - a->beg;
+    }
+    #endif
+    #ifdef UCONFIG_MEMPROF
+    memcharge(total + alignment);
+    #endif
+    return a->end;
+}
+
+static byte *alloc(arena *a, iz size, iz count)
+{
+    return fillbytes(allocraw(a, size, count), 0, size*count);
 }
 
+// Uninitialized string, to be entirely overwritten by the caller.
 static s8 news8(arena *perm, iz len)
 {
     s8 r = {0};
-    r.s = new(perm, u8, len);
+    r.s = (u8 *)allocraw(perm, 1, len);
     r.len = len;
     return r;
 }
@@ -231,9 +448,12 @@ static b32 startswith(s8 s, s8 prefix)
     return s.len>=prefix.len && s8equals(takehead(s, prefix.len), prefix);
 }
 
-static u32 s8hash(s8 s)
+// FNV-1a with the seed mixed into the initial state. Tables index by
+// the high bits, so the seed also decides probe order, and inputs
+// crafted to collide cannot be prepared without knowing it.
+static u32 s8hash(s8 s, u32 seed)
 {
-    u32 h = 0x811c9dc5;
+    u32 h = 0x811c9dc5 ^ seed;
     for (iz i = 0; i < s.len; i++) {
         h ^= s.s[i];
         h *= 0x01000193;
@@ -241,6 +461,30 @@ static u32 s8hash(s8 s)
     return h;
 }
 
+typedef struct {
+    s8  name;
+    i32 id;
+} keyword;
+
+// Perfect hash over a fixed keyword set: the high bits of the seeded
+// hash select a slot holding a keyword index plus one, and a single
+// comparison confirms the match. The seeds and slot tables are plain
+// data, checked (and regenerated on failure) by the test suite.
+typedef struct {
+    const keyword *keys;
+    const u8      *slots;
+    i32            len;
+    i32            exp;
+    u32            seed;
+} keywords;
+
+static i32 keywordid(const keywords *k, s8 name, i32 missing)
+{
+    u32 h = s8hash(name, k->seed);
+    i32 i = k->slots[h >> (32 - k->exp)] - 1;
+    return i>=0 && s8equals(k->keys[i].name, name) ? k->keys[i].id : missing;
+}
+
 typedef struct {
     s8 head;
     s8 tail;
@@ -351,6 +595,21 @@ static s8 s8pathencode(s8 s, arena *perm)
     return r;
 }
 
+static s8 s8pathdecode(s8 s, arena *perm)
+{
+    b32 decode = 0;
+    for (iz i = 0; i<s.len && !decode; i++) {
+        decode = pathdecode(s.s[i]) != s.s[i];
+    }
+    if (!decode) return s;  // no decoding necessary
+
+    s8 r = news8(perm, s.len);
+    for (iz i = 0; i < s.len; i++) {
+        r.s[i] = pathdecode(s.s[i]);
+    }
+    return r;
+}
+
 typedef struct {
     u8    *buf;
     iz     cap;
@@ -404,9 +663,24 @@ static s8 finalize(u8buf *b)
 {
     assert(!b->fd);
     b->perm->beg += b->len;
+    #ifdef UCONFIG_INSTRUMENT
+    if (b->perm->end - b->perm->beg < counters.floor) {
+        counters.floor = b->perm->end - b->perm->beg;
+    }
+    #endif
+    #ifdef UCONFIG_MEMPROF
+    memcharge(b->len);
+    #endif
     return gets8(b);
 }
 
+#ifdef UCONFIG_MEMPROF
+// Attribute the remaining allocators to their callers, too. Buffers
+// that grow in place are charged to the site that finalizes them.
+#  define news8(a, n)   (memsite(MEMSITE("s8")), news8(a, n))
+#  define finalize(b)   (memsite(MEMSITE("membuf")), finalize(b))
+#endif
+
 static void flush(u8buf *b)
 {
     switch (b->fd) {
@@ -414,6 +688,8 @@ static void flush(u8buf *b)
     case  0: oom(b->ctx);
              break;
     default: if (b->len) {
+                 usdt2(output, b->fd, b->len);
+                 tally(written, b->fd==1 ? b->len : 0);
                  os_write(b->ctx, b->fd, gets8(b));
              }
     }
@@ -442,43 +718,434 @@ static void printu8(u8buf *b, u8 c)
     prints8(b, s8span(&c, &c+1));
 }
 
+#if defined(UCONFIG_INSTRUMENT) || defined(UCONFIG_MEMPROF)
+// Print a non-negative integer. Digits are found by subtraction since
+// 32-bit libc-free builds have no 64-bit division routines.
+static void printi64(u8buf *b, i64 x)
+{
+    assert(x >= 0);
+    i64 place[19] = {1};
+    i32 len = 1;
+    for (; len<countof(place) && place[len-1]*10<=x; len++) {
+        place[len] = place[len-1] * 10;
+    }
+    for (i32 i = len-1; i >= 0; i--) {
+        u8 digit = '0';
+        for (; x >= place[i]; x -= place[i]) {
+            digit++;
+        }
+        printu8(b, digit);
+    }
+}
+#endif
+
+#ifdef UCONFIG_MEMPROF
+// Print the allocation profile to standard error, largest sites first.
+// Output goes through static storage since the arena may be exhausted.
+static void memreport(os *ctx)
+{
+    static u8 mem[1<<9];
+    u8buf err = {0};
+    err.buf = mem;
+    err.cap = countof(mem);
+    err.fd  = 2;
+    err.ctx = ctx;
+
+    // Compact and sort in place: the table is finished once reported
+    iz len = 0;
+    memrecord *sites = memprof.sites;
+    for (iz i = 0; i < countof(memprof.sites); i++) {
+        if (sites[i].site) {
+            memrecord r = sites[i];
+            iz j = len++;
+            for (; j>0 && sites[j-1].bytes<r.bytes; j--) {
+                sites[j] = sites[j-1];
+            }
+            sites[j] = r;
+        }
+    }
+
+    iz bytes = 0;
+    iz count = 0;
+    prints8(&err, S("pkg-config: memory profile (bytes, allocations, site)\n"));
+    if (memprof.pending) {
+        prints8(&err, S("  failed at "));
+        prints8(&err, s8fromcstr((u8 *)memprof.pending));
+        printu8(&err, '\n');
+    }
+    for (iz i = 0; i < len; i++) {
+        printu8(&err, '\t');
+        printi64(&err, sites[i].bytes);
+        printu8(&err, '\t');
+        printi64(&err, sites[i].count);
+        printu8(&err, '\t');
+        prints8(&err, s8fromcstr((u8 *)sites[i].site));
+        printu8(&err, '\n');
+        bytes += sites[i].bytes;
+        count += sites[i].count;
+    }
+    printu8(&err, '\t');
+    printi64(&err, bytes);
+    printu8(&err, '\t');
+    printi64(&err, count);
+    prints8(&err, S("\ttotal\n"));
+    flush(&err);
+}
+#endif
+
+// Print as a quoted JSON string. Bytes outside ASCII pass through, so
+// the result is valid JSON when the input is valid UTF-8.
+static void printjson(u8buf *b, s8 s)
+{
+    static const u8 hex[] = "0123456789abcdef";
+    printu8(b, '"');
+    for (iz i = 0; i < s.len; i++) {
+        u8 c = s.s[i];
+        if (c=='"' || c=='\\') {
+            printu8(b, '\\');
+            printu8(b, c);
+        } else if (c == '\n') {
+            prints8(b, S("\\n"));
+        } else if (c == '\t') {
+            prints8(b, S("\\t"));
+        } else if (c < 0x20) {
+            prints8(b, S("\\u00"));
+            printu8(b, hex[c>>4]);
+            printu8(b, hex[c&15]);
+        } else {
+            printu8(b, c);
+        }
+    }
+    printu8(b, '"');
+}
+
+#ifdef UCONFIG_INSTRUMENT
+// Chrome trace events for $PKG_CONFIG_TRACE, in the JSON array format.
+// The closing bracket is optional in this format, and so each process
+// can append its own events to a shared file, and the whole build loads
+// as one trace. The buffer always begins with the opening bracket, for
+// when a flush creates the file, and is flushed only between events.
+typedef struct {
+    u8buf buf;
+    arena scratch;  // for os_append()
+    s8    path;     // null when not tracing
+    i32   pid;
+} tracer;
+
+static tracer trace;
+
+static s8 traceheader = s8("[\n");
+
+static void traceflush(void)
+{
+    if (trace.buf.len > traceheader.len) {
+        s8 data = gets8(&trace.buf);
+        arena scratch = trace.scratch;
+        os_append(trace.buf.ctx, &scratch, trace.path, data, traceheader.len);
+        trace.buf.len = traceheader.len;
+    }
+}
+
+// Ensure room for an event of up to the given length, flushing earlier
+// events if needed. Returns false if the event cannot fit at all. The
+// buffer must never fill, which would flush it mid-event.
+static b32 tracereserve(iz len)
+{
+    if (trace.buf.cap-trace.buf.len <= len) {
+        traceflush();
+    }
+    return trace.buf.cap-trace.buf.len > len;
+}
+
+static i64 tracebegin(os *ctx)
+{
+    return trace.path.s ? os_now(ctx) : 0;
+}
+
+// Record a span begun at tracebegin(), with an argument if non-null.
+static void traceevent(os *ctx, s8 name, s8 key, s8 value, i64 beg)
+{
+    if (!trace.path.s) {
+        return;
+    }
+    i64 end = os_now(ctx);
+    if (!tracereserve(192 + name.len + key.len + value.len*6)) {
+        return;
+    }
+    u8buf *b = &trace.buf;
+    prints8(b, S("{\"name\":"));
+    printjson(b, name);
+    prints8(b, S(",\"cat\":\"u-config\",\"ph\":\"X\",\"ts\":"));
+    printi64(b, beg);
+    prints8(b, S(",\"dur\":"));
+    printi64(b, end>beg ? end-beg : 0);
+    prints8(b, S(",\"pid\":"));
+    printi64(b, trace.pid);
+    prints8(b, S(",\"tid\":"));
+    printi64(b, trace.pid);
+    if (value.s) {
+        prints8(b, S(",\"args\":{"));
+        printjson(b, key);
+        printu8(b, ':');
+        printjson(b, value);
+        printu8(b, '}');
+    }
+    prints8(b, S("},\n"));
+}
+
+static void traceend(os *ctx, s8 name, s8 package, i64 beg)
+{
+    traceevent(ctx, name, S("package"), package, beg);
+}
+
+// Invocation log for $PKG_CONFIG_LOG, one line appended per run, with
+// tab-separated fields: elapsed microseconds, exit status, bytes output,
+// opens attempted, files read, environment hash, packages resolved, and
+// the arguments. Every buffer is reserved up front so that failures,
+// including running out of memory, are still logged.
+typedef struct {
+    u8buf   record;
+    u8buf   packages;  // comma-separated, dropped when full
+    arena   scratch;   // for os_append()
+    s8      path;      // null when not logging
+    u8    **args;
+    i32     nargs;
+    u32     envhash;
+    i64     beg;
+} runlog;
+
+static runlog invocation;
+
+static void logpackage(s8 name)
+{
+    u8buf *b = &invocation.packages;
+    if (invocation.path.s && b->cap-b->len > name.len+1) {
+        if (b->len) {
+            printu8(b, ',');
+        }
+        prints8(b, name);
+    }
+}
+
+// Like prints8(), but clipped to leave room in the record, and with tabs
+// and newlines blanked so that the record remains one line of fields.
+static void logs8(u8buf *b, s8 s)
+{
+    iz room = b->cap - b->len - 1;  // reserve the final newline
+    for (iz i = 0; i<s.len && i<room; i++) {
+        u8 c = s.s[i];
+        b->buf[b->len++] = c=='\t' || c=='\n' || c=='\r' ? ' ' : c;
+    }
+}
+
+static void logtab(u8buf *b)
+{
+    if (b->cap-b->len > 1) {
+        b->buf[b->len++] = '\t';
+    }
+}
+
+static void lognumber(u8buf *b, i64 x)
+{
+    u8 mem[24];  // more than 19 digits, so it never flushes
+    u8buf tmp = {0};
+    tmp.buf = mem;
+    tmp.cap = countof(mem);
+    printi64(&tmp, x);
+    logs8(b, gets8(&tmp));
+}
+
+static void logrun(os *ctx, i32 status)
+{
+    if (!invocation.path.s) {
+        return;
+    }
+    s8 path = invocation.path;
+    invocation.path = (s8){0};  // log once, even if this fails
+
+    static const u8 hex[] = "0123456789abcdef";
+    u8 envhash[8];
+    for (i32 i = 0; i < 8; i++) {
+        envhash[i] = hex[invocation.envhash>>(28 - 4*i) & 15];
+    }
+
+    u8buf *b = &invocation.record;
+    i64 now = os_now(ctx);
+    lognumber(b, now>invocation.beg ? now-invocation.beg : 0);
+    logtab(b);
+    lognumber(b, status);
+    logtab(b);
+    lognumber(b, counters.written);
+    logtab(b);
+    lognumber(b, counters.opens);
+    logtab(b);
+    lognumber(b, counters.files);
+    logtab(b);
+    logs8(b, (s8){envhash, countof(envhash)});
+    logtab(b);
+    logs8(b, gets8(&invocation.packages));
+    logtab(b);
+    for (i32 i = 0; i < invocation.nargs; i++) {
+        if (i) {
+            logs8(b, S(" "));
+        }
+        logs8(b, s8fromcstr(invocation.args[i]));
+    }
+    b->buf[b->len++] = '\n';
+
+    arena scratch = invocation.scratch;
+    os_append(ctx, &scratch, path, gets8(b), 0);
+}
+
+#else
+#  define tracebegin(ctx)                  ((void)(ctx), (i64)0)
+#  define traceend(ctx, name, package, beg)  (void)(beg)
+#  define logpackage(name)                 (void)(name)
+#  define logrun(ctx, status)              (void)(ctx)
+#  define traceflush()                     (void)0
+#endif
+
+// Exit unsuccessfully, keeping the trace so far and logging the
+// invocation first.
+static void fail(os *ctx)
+{
+    traceflush();
+    logrun(ctx, 1);
+    os_fail(ctx);
+}
+
+typedef struct {
+    s8  name;
+    s8  value;
+    u32 hash;
+} binding;
+
+// Variables are stored densely in definition order, and indexed by an
+// open-addressing, linear probe table of twice the capacity. Indexes
+// come from the high hash bits, which are best mixed.
 typedef struct env env;
 struct env {
-    env *child[4];
-    s8   name;
-    s8   value;
+    binding *vars;
+    i32     *slots;  // index into vars, plus one, or zero if empty
+    i32      len;
+    i32      exp;    // slots holds 1<<exp entries, vars half as many
+    u32      seed;
 };
 
-// Return a pointer to the binding so that the caller can bind it. The
-// arena is optional. If given, the binding will be created and set to a
-// null string. A null pointer is a valid empty environment.
-static s8 *insert(env **e, s8 name, arena *perm)
+static env *newenv(arena *perm, u32 seed)
+{
+    env *e = new(perm, env, 1);
+    e->exp   = 4;
+    e->vars  = new(perm, binding, (iz)1<<(e->exp - 1));
+    e->slots = new(perm, i32, (iz)1<<e->exp);
+    e->seed  = seed;
+    return e;
+}
+
+static void rehash(env *e, arena *perm)
+{
+    binding *vars = new(perm, binding, (iz)1<<e->exp);
+    u8copy((u8 *)vars, (u8 *)e->vars, e->len*(iz)sizeof(*vars));
+    e->vars  = vars;
+    e->exp++;
+    e->slots = new(perm, i32, (iz)1<<e->exp);
+    u32 mask = ((u32)1<<e->exp) - 1;
+    for (i32 v = 0; v < e->len; v++) {
+        u32 i = e->vars[v].hash >> (32 - e->exp);
+        for (; e->slots[i]; i = (i + 1)&mask) {}
+        e->slots[i] = v + 1;
+    }
+}
+
+// Find or, if an arena is given, create a binding with a null value. A
+// null pointer is a valid empty environment, and is replaced with a new
+// environment hashed under the given seed on first insertion. Insertion
+// may move bindings, invalidating previously returned pointers.
+static binding *bind(env **e, s8 name, u32 seed, arena *perm)
 {
-    for (u32 h = s8hash(name); *e; h <<= 2) {
-        if (s8equals((*e)->name, name)) {
-            return &(*e)->value;
+    if (!*e) {
+        if (!perm) {
+            return 0;
+        }
+        *e = newenv(perm, seed);
+    }
+
+    env *t = *e;
+    u32 hash = s8hash(name, t->seed);
+    u32 mask = ((u32)1<<t->exp) - 1;
+    u32 i = hash >> (32 - t->exp);
+    for (; t->slots[i]; i = (i + 1)&mask) {
+        binding *b = t->vars + t->slots[i] - 1;
+        if (b->hash==hash && s8equals(b->name, name)) {
+            return b;
         }
-        e = &(*e)->child[h>>30];
     }
     if (!perm) {
         return 0;
     }
-    *e = new(perm, env, 1);
-    (*e)->name = name;
-    return &(*e)->value;
+
+    if (t->len == 1<<(t->exp - 1)) {
+        rehash(t, perm);
+        return bind(e, name, seed, perm);
+    }
+    t->slots[i] = ++t->len;
+    binding *b = t->vars + t->len - 1;
+    b->name = name;
+    b->hash = hash;
+    return b;
+}
+
+// Return a pointer to the binding so that the caller can bind it. The
+// arena is optional. If given, the binding will be created and set to a
+// null string. A null pointer is a valid empty environment.
+static s8 *insert(env **e, s8 name, u32 seed, arena *perm)
+{
+    binding *b = bind(e, name, seed, perm);
+    return b ? &b->value : 0;
+}
+
+// Intern a string, returning a small, dense identifier: its index in
+// definition order. The table keeps the first copy of each string, so
+// the caller may release the memory of a string seen before.
+static i32 intern(env **t, s8 s, u32 seed, arena *perm)
+{
+    binding *b = bind(t, s, seed, perm);
+    b->value = b->name;
+    return (i32)(b - (*t)->vars);
+}
+
+// Find a binding given a hash computed under a particular seed, only
+// re-hashing if the environment uses a different seed.
+static binding *find(env *e, s8 name, u32 seed, u32 hash)
+{
+    if (!e) {
+        return 0;
+    }
+    hash = e->seed==seed ? hash : s8hash(name, e->seed);
+    u32 mask = ((u32)1<<e->exp) - 1;
+    u32 i = hash >> (32 - e->exp);
+    for (; e->slots[i]; i = (i + 1)&mask) {
+        binding *b = e->vars + e->slots[i] - 1;
+        if (b->hash==hash && s8equals(b->name, name)) {
+            return b;
+        }
+    }
+    return 0;
 }
 
 // Try to find the binding in the global environment, then failing that,
 // the second environment. Returns a null string if no entry was found.
-// A null pointer is valid for lookups.
+// A null pointer is valid for lookups. Environments normally share a
+// seed, in which case the name is hashed just once.
 static s8 lookup(env *global, env *env, s8 name)
 {
-    s8 *s = 0;
     s8 null = {0};
-    s = s ? s : insert(&global, name, 0);
-    s = s ? s : insert(&env,    name, 0);
-    s = s ? s : &null;
-    return *s;
+    u32 seed = global ? global->seed : env ? env->seed : 0;
+    u32 hash = s8hash(name, seed);
+    binding *b = 0;
+    b = b ? b : find(global, name, seed, hash);
+    b = b ? b : find(env,    name, seed, hash);
+    return b ? b->value : null;
 }
 
 static s8 dirname(s8 path)
@@ -570,108 +1237,239 @@ struct pkgspec {
 
 enum { pkg_DIRECT=1<<0, pkg_PUBLIC=1<<1 };
 
-typedef struct pkg pkg;
-struct pkg {
-    pkg     *child[4];
-    pkg     *list;  // total load order list
+enum {
+    field_NAME,
+    field_DESCRIPTION,
+    field_URL,
+    field_VERSION,
+    field_REQUIRES,
+    field_REQUIRESPRIVATE,
+    field_CONFLICTS,
+    field_LIBS,
+    field_LIBSPRIVATE,
+    field_CFLAGS,
+    field_CFLAGSPRIVATE,
+    PKG_NFIELDS
+};
+
+// A package embedded at build time (see main_snapshot.c). Variables and
+// fields are pre-parsed. Fields are also pre-expanded unless expansion
+// depends on run-time global variables.
+typedef struct {
+    s8  realname;
+    s8  path;
+    s8 *vars;      // name and value pairs, in definition order
+    i32 nvars;
+    i32 dir;       // index into the snapshot's directories
+    s8  fields[PKG_NFIELDS];
+    u8 *expanded;  // fields back to back, or null
+    i32 ends[PKG_NFIELDS];
+    u32 hash;      // of realname, zero seed
+} snapshotpkg;
+
+// Every .pc file in the snapshot's directories is embedded, so probes of
+// these directories are answered without file I/O, hit or miss.
+typedef struct {
+    s8          *dirs;
+    i32          ndirs;
+    snapshotpkg *pkgs;
+    i32          npkgs;
+    b32          define_prefix;  // assumed by pre-expanded fields
+} snapshot;
+
+#ifdef PKG_CONFIG_SNAPSHOT
+#  include PKG_CONFIG_SNAPSHOT  // defines "embedded"
+#else
+static snapshot embedded;
+#endif
+
+// A package as parsed from its .pc file, before variable expansion.
+typedef struct {
+    s8           path;
+    s8           realname;
+    env         *env;
+    snapshotpkg *embedded;
+    s8           fields[PKG_NFIELDS];
+} pcfile;
+
+// A loaded package. Expanded fields are stored back to back in a single
+// buffer and addressed by 32-bit end offsets.
+typedef struct {
     s8       path;
     s8       realname;
-    s8       contents;
     env     *env;
     pkgspec *specs_requires;
     pkgspec *specs_requiresprivate;
+    u8      *data;     // null until loaded
+    i32      ends[PKG_NFIELDS];
+    i32      present;  // bit set of fields defined in the .pc file
     i32      flags;
+    u32      hash;
+} pkg;
 
-    #define PKG_NFIELDS 11
-    s8 name;
-    s8 description;
-    s8 url;
-    s8 version;
-    s8 requires;
-    s8 requiresprivate;
-    s8 conflicts;
-    s8 libs;
-    s8 libsprivate;
-    s8 cflags;
-    s8 cflagsprivate;
-};
-
-static s8 *fieldbyid(pkg *p, i32 id)
+static s8 getfield(pkg *p, i32 id)
 {
     assert(id >= 0);
     assert(id < PKG_NFIELDS);
-    return (s8 *)((byte *)&p->name + id*(i32)sizeof(s8));
-}
-
-static s8 *fieldbyname(pkg *p, s8 name)
-{
-    static const s8 fields[] = {
-        s8("Name"),
-        s8("Description"),
-        s8("URL"),
-        s8("Version"),
-        s8("Requires"),
-        s8("Requires.private"),
-        s8("Conflicts"),
-        s8("Libs"),
-        s8("Libs.private"),
-        s8("Cflags"),
-        s8("Cflags.private")
-    };
-    for (i32 i = 0; i < countof(fields); i++) {
-        if (s8equals(fields[i], name)) {
-            return fieldbyid(p, i);
-        }
-    }
-    return 0;
+    assert(p->data);
+    i32 beg = id ? p->ends[id-1] : 0;
+    return s8span(p->data+beg, p->data+p->ends[id]);
+}
+
+static const keyword fieldkeys[] = {
+    {s8("Name"),             field_NAME},
+    {s8("Description"),      field_DESCRIPTION},
+    {s8("URL"),              field_URL},
+    {s8("Version"),          field_VERSION},
+    {s8("Requires"),         field_REQUIRES},
+    {s8("Requires.private"), field_REQUIRESPRIVATE},
+    {s8("Conflicts"),        field_CONFLICTS},
+    {s8("Libs"),             field_LIBS},
+    {s8("Libs.private"),     field_LIBSPRIVATE},
+    {s8("Cflags"),           field_CFLAGS},
+    {s8("Cflags.private"),   field_CFLAGSPRIVATE},
+};
+
+static const u8 fieldslots[1<<4] = {
+    8, 6, 10, 0, 0, 9, 5, 7, 1, 3, 4, 2, 0, 11, 0, 0,
+};
+
+static const keywords fieldtable = {
+    fieldkeys, fieldslots, countof(fieldkeys), 4, 0x3c
+};
+
+static s8 *fieldbyname(pcfile *p, s8 name)
+{
+    i32 id = keywordid(&fieldtable, name, -1);
+    return id<0 ? 0 : p->fields+id;
 }
 
 typedef struct {
-    pkg *pkgs;
-    pkg *head;
-    iz   count;
+    u32 hash;
+    i32 index;  // record index plus one, or zero if empty
+} pkgslot;
+
+// Set of loaded packages. Records are stored contiguously, indexed by
+// an open-addressing, linear probe table of twice the capacity. Records
+// are in discovery order during traversal, and in load order after.
+typedef struct {
+    pkg     *recs;
+    i32     *order;  // record indexes in order of completion (traversal)
+    pkgslot *slots;
+    iz       count;
+    iz       nloaded;
+    i32      exp;    // slots holds 1<<exp entries, records half as many
+    u32      seed;
 } pkgs;
 
+// Populate a zeroed slot table from the records.
+static void reindex(pkgs *t)
+{
+    u32 mask = ((u32)1<<t->exp) - 1;
+    for (iz r = 0; r < t->count; r++) {
+        u32 i = t->recs[r].hash >> (32 - t->exp);
+        for (; t->slots[i].index; i = (i + 1)&mask) {}
+        t->slots[i].hash  = t->recs[r].hash;
+        t->slots[i].index = (i32)r + 1;
+    }
+}
+
+static void resize(pkgs *t, i32 exp, arena *perm)
+{
+    iz cap = (iz)1<<(exp - 1);
+    pkg *recs = new(perm, pkg, cap);
+    u8copy((u8 *)recs, (u8 *)t->recs, t->count*(iz)sizeof(*recs));
+    i32 *order = new(perm, i32, cap);
+    u8copy((u8 *)order, (u8 *)t->order, t->nloaded*(iz)sizeof(*order));
+    t->recs  = recs;
+    t->order = order;
+    t->exp   = exp;
+    t->slots = new(perm, pkgslot, (iz)1<<exp);
+    reindex(t);
+}
+
+static pkgs newpkgs(arena *perm, u32 seed)
+{
+    pkgs t = {0};
+    t.seed = seed;
+    resize(&t, 6, perm);
+    return t;
+}
+
 // Locate a previously-loaded package, or allocate zero-initialized
-// space in the set for a new package.
+// space in the set for a new package. Records may move on allocation,
+// invalidating previously returned pointers.
 static pkg *locate(pkgs *t, s8 realname, arena *perm)
 {
-    pkg **p = &t->pkgs;
-    for (u32 h = s8hash(realname); *p; h <<= 2) {
-        if (s8equals((*p)->realname, realname)) {
-            return *p;
+    u32 hash = s8hash(realname, t->seed);
+    u32 mask = ((u32)1<<t->exp) - 1;
+    u32 i = hash >> (32 - t->exp);
+    for (; t->slots[i].index; i = (i + 1)&mask) {
+        pkgslot *s = t->slots + i;
+        pkg *p = t->recs + s->index - 1;
+        if (s->hash==hash && s8equals(p->realname, realname)) {
+            return p;
         }
-        p = &(*p)->child[h>>30];
     }
 
-    *p = new(perm, pkg, 1);
-    (*p)->realname = realname;
-    t->count++;
-    return *p;
+    if (t->count == (iz)1<<(t->exp - 1)) {
+        resize(t, t->exp+1, perm);
+        return locate(t, realname, perm);
+    }
+    t->slots[i].hash  = hash;
+    t->slots[i].index = (i32)++t->count;
+    pkg *p = t->recs + t->count - 1;
+    p->realname = realname;
+    p->hash = hash;
+    return p;
 }
 
-static void prepend(pkgs *t, pkg *p)
+// Record that a package and its dependencies have been loaded.
+static void markloaded(pkgs *t, i32 index)
 {
-    assert(!p->list);
-    p->list = t->head;
-    t->head = p;
+    assert(t->nloaded < t->count);
+    t->order[t->nloaded++] = index;
 }
 
-static b32 allpresent(pkgs t)
+// Permute records into load order, last completed first, so that the
+// output passes walk records front to back. Done in place by following
+// permutation cycles, consuming the order array.
+static void sortbyload(pkgs *t)
 {
-    iz count = 0;
-    for (pkg *p = t.head; p; p = p->list) {
-        count++;
+    assert(t->nloaded == t->count);
+    i32 *src = t->order;
+    for (iz i = 0; i < t->count/2; i++) {
+        i32 swap = src[i];
+        src[i] = src[t->count-1-i];
+        src[t->count-1-i] = swap;
+    }
+
+    for (iz i = 0; i < t->count; i++) {
+        if (src[i] < 0) {
+            continue;  // already placed
+        }
+        pkg first = t->recs[i];
+        iz j = i;
+        while (src[j] != i) {
+            iz k = src[j];
+            t->recs[j] = t->recs[k];
+            src[j] = -1;
+            j = k;
+        }
+        t->recs[j] = first;
+        src[j] = -1;
     }
-    return count == t.count;
+
+    fillbytes((byte *)t->slots, 0, ((iz)1<<t->exp)*(iz)sizeof(*t->slots));
+    reindex(t);
 }
 
 enum { parse_OK, parse_DUPFIELD, parse_DUPVARABLE };
 
 typedef struct {
-    pkg pkg;
-    s8  dupname;
-    i32 err;
+    pcfile pc;
+    s8     dupname;
+    i32    err;
 } parseresult;
 
 // Return the number of escape bytes at the beginning of the input.
@@ -731,7 +1529,7 @@ static void checknotop(u8buf *err, s8 tok, pkg *p)
         }
         prints8(err, S("\n"));
         flush(err);
-        os_fail(err->ctx);
+        fail(err->ctx);
     }
 }
 
@@ -747,7 +1545,7 @@ static void opfail(u8buf *err, versop op, pkg *p)
     }
     prints8(err, S("\n"));
     flush(err);
-    os_fail(err->ctx);
+    fail(err->ctx);
 }
 
 static pkgspec *parsespecs(s8 *args, iz nargs, pkg *p, u8buf *err, arena *a)
@@ -788,13 +1586,13 @@ static pkgspec *parsespecs(s8 *args, iz nargs, pkg *p, u8buf *err, arena *a)
     return head;
 }
 
-static parseresult parsepackage(s8 src, arena *perm)
+static parseresult parsepackage(s8 src, u32 seed, arena *perm)
 {
     u8 *p = src.s;
     u8 *e = src.s + src.len;
     parseresult result = {0};
     result.err = parse_OK;
-    result.pkg.contents = src;
+    result.pc.env = newenv(perm, seed);
 
     while (p < e) {
         for (; p<e && whitespace(*p); p++) {}
@@ -821,7 +1619,7 @@ static parseresult parsepackage(s8 src, arena *perm)
             continue;
 
         case '=':
-            field = insert(&result.pkg.env, name, perm);
+            field = insert(&result.pc.env, name, seed, perm);
             if (field->s) {
                 parseresult dup = {0};
                 dup.dupname = name;
@@ -831,7 +1629,7 @@ static parseresult parsepackage(s8 src, arena *perm)
             break;
 
         case ':':
-            field = fieldbyname(&result.pkg, name);
+            field = fieldbyname(&result.pc, name);
             if (field && field->s) {
                 parseresult dup = {0};
                 dup.dupname = name;
@@ -901,7 +1699,7 @@ static void missing(u8buf *err, s8 option)
     prints8(err, option);
     prints8(err, S("\n"));
     flush(err);
-    os_fail(err->ctx);
+    fail(err->ctx);
 }
 
 typedef struct {
@@ -977,18 +1775,29 @@ static void usage(u8buf *b)
     "  --cflags, --cflags-only-I, --cflags-only-other\n"
     "  --define-prefix, --dont-define-prefix\n"
     "  --define-variable=NAME=VALUE, --variable=NAME\n"
+    "  --variables=NAME,..., --print-variables\n"
     "  --exists, --validate, --{atleast,exact,max}-version=VERSION\n"
+    "  --emit=make|ninja|sh|cmake\n"
     "  --errors-to-stdout\n"
+    "  --json\n"
     "  --keep-system-cflags, --keep-system-libs\n"
     "  --libs, --libs-only-L, --libs-only-l, --libs-only-other\n"
     "  --list-all\n"
     "  --list-package-names\n"
+    #ifdef UCONFIG_INSTRUMENT
+    "  --log-summary[=FILE]\n"
+    #endif
     "  --maximum-traverse-depth=N\n"
     "  --modversion\n"
     "  --msvc-syntax\n"
     "  --newlines\n"
+    "  --print-graph=dot|json\n"
+    "  --sections\n"
     "  --silence-errors\n"
     "  --static\n"
+    #ifdef UCONFIG_INSTRUMENT
+    "  --stats\n"
+    #endif
     "  --with-path=PATH\n"
     "  -h, --help, --version\n"
     "environment:\n"
@@ -998,7 +1807,13 @@ static void usage(u8buf *b)
     "  PKG_CONFIG_SYSTEM_INCLUDE_PATH\n"
     "  PKG_CONFIG_SYSTEM_LIBRARY_PATH\n"
     "  PKG_CONFIG_ALLOW_SYSTEM_CFLAGS\n"
-    "  PKG_CONFIG_ALLOW_SYSTEM_LIBS\n";
+    "  PKG_CONFIG_ALLOW_SYSTEM_LIBS\n"
+    "  PKG_CONFIG_CACHE\n"
+    #ifdef UCONFIG_INSTRUMENT
+    "  PKG_CONFIG_TRACE\n"
+    "  PKG_CONFIG_LOG\n"
+    #endif
+    ;
     prints8(b, S(usage));
 }
 
@@ -1088,9 +1903,12 @@ static s8 readpackage(u8buf *err, s8 path, s8 realname, arena *perm)
     }
 
     s8 null = {0};
+    tally(opens, 1);
     filemap m = os_mapfile(perm->ctx, perm, path);
     switch (m.status) {
     case filemap_NOTFOUND:
+        tally(openfails, 1);
+        usdt1(file_miss, path.s);
         return null;
 
     case filemap_READERR:
@@ -1101,15 +1919,21 @@ static s8 readpackage(u8buf *err, s8 path, s8 realname, arena *perm)
         prints8(err, path);
         prints8(err, S("'\n"));
         flush(err);
-        os_fail(err->ctx);
+        fail(err->ctx);
 
     case filemap_OK:
+        tally(files, 1);
+        tally(bytes, m.data.len);
+        usdt1(file_hit, path.s);
         return m.data;
     }
     assert(0);
 }
 
-static void expand(u8buf *out, u8buf *err, env *global, pkg *p, s8 str)
+// Expand variables using a package environment, with the path of its
+// .pc file for error messages.
+static void expand(
+    u8buf *out, u8buf *err, env *global, env *env, s8 path, s8 str)
 {
     i32 top = 0;
     s8 stack[128];
@@ -1122,10 +1946,10 @@ static void expand(u8buf *out, u8buf *err, env *global, pkg *p, s8 str)
                 if (top >= countof(stack)-2) {
                     prints8(err, S("pkg-config: "));
                     prints8(err, S("exceeded max recursion depth in '"));
-                    prints8(err, p->path);
+                    prints8(err, path);
                     prints8(err, S("'\n"));
                     flush(err);
-                    os_fail(err->ctx);
+                    fail(err->ctx);
                 }
 
                 prints8(out, takehead(s, i));
@@ -1143,16 +1967,18 @@ static void expand(u8buf *out, u8buf *err, env *global, pkg *p, s8 str)
                 s8 tail = cuthead(s, end);
                 stack[++top] = tail;
 
-                s8 value = lookup(global, p->env, name);
+                tally(expansions, 1);
+                usdt2(expand, name.s, name.len);
+                s8 value = lookup(global, env, name);
                 if (!value.s) {
                     prints8(err, S("pkg-config: "));
                     prints8(err, S("undefined variable '"));
                     prints8(err, name);
                     prints8(err, S("' in '"));
-                    prints8(err, p->path);
+                    prints8(err, path);
                     prints8(err, S("'\n"));
                     flush(err);
-                    os_fail(err->ctx);
+                    fail(err->ctx);
                 }
                 stack[++top] = value;
                 s.len = 0;
@@ -1170,111 +1996,279 @@ static void expand(u8buf *out, u8buf *err, env *global, pkg *p, s8 str)
     }
 }
 
-// Merge and expand data from "update" into "base".
-static void expandmerge(u8buf *err, env *g, pkg *base, pkg *update, arena *perm)
-{
-    base->path = update->path;
-    base->contents = update->contents;
-    base->env = update->env;
-    base->flags = update->flags;
-    for (i32 i = 0; i < PKG_NFIELDS; i++) {
-        u8buf mem = newmembuf(perm);
-        s8 src = *fieldbyid(update, i);
-        expand(&mem, err, g, update, src);
-        *fieldbyid(base, i) = finalize(&mem);
-    }
-
-    base->specs_requires = parsespecs(
-        &base->requires, 1, base, err, perm
-    );
-    base->specs_requiresprivate = parsespecs(
-        &base->requiresprivate, 1, base, err, perm
-    );
-}
-
-static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
+// Expand a variable like expand(), but memoize the expansion of it and
+// of every variable it references, so that variables shared by several
+// requests are expanded only once.
+static s8 expandvar(
+    env **memo, u8buf *err, env *global, env *env, s8 path, s8 name,
+    i32 depth, arena *perm)
 {
-    s8 path = {0};
-    s8 contents = {0};
-
-    if (realnameispath(realname)) {
-        path = news8(perm, realname.len+1);
-        s8copy(path, realname).s[0] = 0;
-        contents = readpackage(err, path, realname, perm);
-        path = cuttail(path, 1);  // remove null terminator
-        if (contents.s) {
-            realname = pathtorealname(path);
-        }
-    }
-
-    for (s8node *n = dirs->list.head; n && !contents.s; n = n->next) {
-        path = buildpath(n->str, realname, perm);
-        contents = readpackage(err, path, realname, perm);
-        path = cuttail(path, 1);  // remove null terminator
+    s8 done = lookup(0, *memo, name);
+    if (done.s) {
+        return done;
     }
+    tally(expansions, 1);
+    usdt2(expand, name.s, name.len);
 
-    if (!contents.s) {
+    if (depth >= 128) {
         prints8(err, S("pkg-config: "));
-        prints8(err, S("could not find package '"));
-        prints8(err, realname);
+        prints8(err, S("exceeded max recursion depth in '"));
+        prints8(err, path);
         prints8(err, S("'\n"));
         flush(err);
-        os_fail(err->ctx);
+        fail(err->ctx);
     }
 
-    parseresult r = parsepackage(contents, perm);
-    switch (r.err) {
-    case parse_DUPVARABLE:
+    s8 value = lookup(global, env, name);
+    if (!value.s) {
         prints8(err, S("pkg-config: "));
-        prints8(err, S("duplicate variable '"));
-        prints8(err, r.dupname);
+        prints8(err, S("undefined variable '"));
+        prints8(err, name);
         prints8(err, S("' in '"));
         prints8(err, path);
         prints8(err, S("'\n"));
         flush(err);
-        os_fail(err->ctx);
+        fail(err->ctx);
+    }
 
-    case parse_DUPFIELD:
-        prints8(err, S("pkg-config: "));
-        prints8(err, S("duplicate field '"));
-        prints8(err, r.dupname);
-        prints8(err, S("' in '"));
-        prints8(err, path);
-        prints8(err, S("'\n"));
-        flush(err);
-        os_fail(err->ctx);
+    // Expand references first, since the buffer below locks the arena
+    for (iz i = 0; i < value.len-1; i++) {
+        if (value.s[i]=='$' && value.s[i+1]=='$') {
+            i++;
+        } else if (value.s[i]=='$' && value.s[i+1]=='{') {
+            iz beg = i + 2;
+            iz end = beg;
+            for (; end<value.len && value.s[end]!='}'; end++) {}
+            s8 ref = s8span(value.s+beg, value.s+end);
+            expandvar(memo, err, global, env, path, ref, depth+1, perm);
+            i = end;
+        }
+    }
+
+    u8buf mem = newmembuf(perm);
+    for (iz i = 0; i < value.len; i++) {
+        if (i+1<value.len && value.s[i]=='$' && value.s[i+1]=='$') {
+            printu8(&mem, '$');
+            i++;
+        } else if (i+1<value.len && value.s[i]=='$' && value.s[i+1]=='{') {
+            iz beg = i + 2;
+            iz end = beg;
+            for (; end<value.len && value.s[end]!='}'; end++) {}
+            s8 ref = s8span(value.s+beg, value.s+end);
+            prints8(&mem, lookup(0, *memo, ref));
+            i = end;
+        } else {
+            printu8(&mem, value.s[i]);
+        }
+    }
+    s8 r = finalize(&mem);
+    *insert(memo, name, env->seed, perm) = r;
+    return r;
+}
+
+// Expand a parsed .pc file into a package record.
+static void expandmerge(u8buf *err, env *g, pkg *p, pcfile *pc, arena *perm)
+{
+    i64 beg = tracebegin(perm->ctx);
+    p->path = pc->path;
+    p->env  = pc->env;
+    u8buf mem = newmembuf(perm);
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        expand(&mem, err, g, pc->env, pc->path, pc->fields[i]);
+        if (mem.len > 0x7fffffff) {
+            oom(perm->ctx);  // offsets are 32 bits
+        }
+        p->ends[i] = (i32)mem.len;
+        p->present |= pc->fields[i].s ? 1<<i : 0;
+    }
+    p->data = finalize(&mem).s;
+
+    s8 requires = getfield(p, field_REQUIRES);
+    p->specs_requires = parsespecs(&requires, 1, p, err, perm);
+    s8 requiresprivate = getfield(p, field_REQUIRESPRIVATE);
+    p->specs_requiresprivate = parsespecs(&requiresprivate, 1, p, err, perm);
+    traceend(perm->ctx, S("expandmerge"), pc->realname, beg);
+}
+
+// Like expandmerge(), but with the embedded pre-expanded fields.
+static void embedmerge(u8buf *err, pkg *p, pcfile *pc, arena *perm)
+{
+    snapshotpkg *e = pc->embedded;
+    p->path = pc->path;
+    p->env  = pc->env;
+    p->data = e->expanded;
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        p->ends[i] = e->ends[i];
+        p->present |= e->fields[i].s ? 1<<i : 0;
+    }
+    s8 requires = getfield(p, field_REQUIRES);
+    p->specs_requires = parsespecs(&requires, 1, p, err, perm);
+    s8 requiresprivate = getfield(p, field_REQUIRESPRIVATE);
+    p->specs_requiresprivate = parsespecs(&requiresprivate, 1, p, err, perm);
+}
+
+// Return the snapshot index of a search directory, or -1 if not covered.
+static i32 embeddeddir(s8 dir)
+{
+    for (i32 i = 0; i < embedded.ndirs; i++) {
+        if (s8equals(embedded.dirs[i], dir)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static snapshotpkg *embeddedpkg(i32 dir, s8 realname)
+{
+    u32 hash = s8hash(realname, 0);
+    for (i32 i = 0; i < embedded.npkgs; i++) {
+        snapshotpkg *e = embedded.pkgs + i;
+        if (e->hash==hash && e->dir==dir && s8equals(e->realname, realname)) {
+            return e;
+        }
+    }
+    return 0;
+}
+
+// Rebuild the parse result of an embedded package.
+static parseresult unpack(snapshotpkg *e, u32 seed, arena *perm)
+{
+    parseresult r = {0};
+    r.pc.env = newenv(perm, seed);
+    for (i32 i = 0; i < e->nvars; i++) {
+        *insert(&r.pc.env, e->vars[2*i], seed, perm) = e->vars[2*i+1];
+    }
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        r.pc.fields[i] = e->fields[i];
+    }
+    r.pc.embedded = e;
+    r.err = parse_OK;
+    return r;
+}
+
+// Find and parse a package, failing on errors. When probing, errors
+// instead return a zero pcfile.
+static pcfile findpackage(
+    search *dirs, u8buf *err, s8 realname, u32 seed, b32 probe, arena *perm)
+{
+    s8 path = {0};
+    s8 contents = {0};
+
+    // Failed probes are rolled back so that dead paths do not pile up
+    arena rollback = *perm;
+
+    if (realnameispath(realname)) {
+        path = news8(perm, realname.len+1);
+        s8copy(path, realname).s[0] = 0;
+        contents = readpackage(err, path, realname, perm);
+        path = cuttail(path, 1);  // remove null terminator
+        if (contents.s) {
+            realname = pathtorealname(path);
+        } else {
+            *perm = rollback;
+        }
+    }
+
+    // The virtual pkg-config package is never embedded
+    b32 virtual = s8equals(realname, S("pkg-config"));
+    snapshotpkg *e = 0;
+    for (s8node *n = dirs->list.head; n && !contents.s; n = n->next) {
+        tally(dirs, 1);
+        i32 dir = virtual ? -1 : embeddeddir(n->str);
+        if (dir >= 0) {
+            e = embeddedpkg(dir, realname);
+            if (e) {
+                path = e->path;
+                break;
+            }
+            continue;
+        }
+
+        path = buildpath(n->str, realname, perm);
+        contents = readpackage(err, path, realname, perm);
+        path = cuttail(path, 1);  // remove null terminator
+        if (!contents.s) {
+            *perm = rollback;
+        }
+    }
+
+    if (!contents.s && !e) {
+        if (probe) {
+            return (pcfile){0};
+        }
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("could not find package '"));
+        prints8(err, realname);
+        prints8(err, S("'\n"));
+        flush(err);
+        fail(err->ctx);
+    }
+
+    i64 beg = tracebegin(perm->ctx);
+    usdt2(parse_start, realname.s, realname.len);
+    parseresult r = e ? unpack(e, seed, perm)
+                      : parsepackage(contents, seed, perm);
+    usdt2(parse_done, realname.s, realname.len);
+    traceend(perm->ctx, e ? S("unpack") : S("parsepackage"), realname, beg);
+    if (probe && r.err) {
+        *perm = rollback;
+        return (pcfile){0};
+    }
+    switch (r.err) {
+    case parse_DUPVARABLE:
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("duplicate variable '"));
+        prints8(err, r.dupname);
+        prints8(err, S("' in '"));
+        prints8(err, path);
+        prints8(err, S("'\n"));
+        flush(err);
+        fail(err->ctx);
+
+    case parse_DUPFIELD:
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("duplicate field '"));
+        prints8(err, r.dupname);
+        prints8(err, S("' in '"));
+        prints8(err, path);
+        prints8(err, S("'\n"));
+        flush(err);
+        fail(err->ctx);
 
     case parse_OK:
         break;
     }
-    r.pkg.path = path;
-    r.pkg.realname = realname;
+    r.pc.path = path;
+    r.pc.realname = realname;
     s8 pcfiledir = s8pathencode(dirname(path), perm);
-    *insert(&r.pkg.env, S("pcfiledir"), perm) = pcfiledir;
+    *insert(&r.pc.env, S("pcfiledir"), seed, perm) = pcfiledir;
 
     s8 missing = {0};
-    if (!r.pkg.name.s) {
+    if (!r.pc.fields[field_NAME].s) {
         missing = S("Name");
-    } else if (!r.pkg.version.s) {
+    } else if (!r.pc.fields[field_VERSION].s) {
         missing = S("Version");
-    } else if (!r.pkg.description.s) {
+    } else if (!r.pc.fields[field_DESCRIPTION].s) {
         missing = S("Description");
     }
     if (missing.s) {
+        if (probe) {
+            return (pcfile){0};
+        }
         prints8(err, S("pkg-config: "));
         prints8(err, S("missing field '"));
         prints8(err, missing);
         prints8(err, S("' in '"));
-        prints8(err, r.pkg.path);
+        prints8(err, r.pc.path);
         prints8(err, S("'\n"));
         flush(err);
         #ifndef FUZZTEST
         // Do not enforce during fuzzing
-        os_fail(err->ctx);
+        fail(err->ctx);
         #endif
     }
 
-    return r.pkg;
+    return r.pc;
 }
 
 typedef struct {
@@ -1416,22 +2410,45 @@ static i32 compareversions(s8 va, s8 vb)
     return 0;
 }
 
+// Traversal frame, one per visited package. Requires.private is walked
+// before Requires, and the package is marked loaded when it pops.
+typedef struct procstate procstate;
+struct procstate {
+    procstate *next;
+    pkgspec   *private;
+    pkgspec   *public;
+    i32        newpkg;  // record index plus one
+    i32        depth;
+    i32        flags;   // flags for packages on the public list
+};
+
+// A dependency edge as walked by process(), i.e. each Requires and
+// Requires.private entry of each loaded package, plus the command line.
+typedef struct edge edge;
+struct edge {
+    edge    *next;
+    s8       from;     // realname, or null for the command line
+    s8       to;       // realname
+    pkgspec *spec;     // as written, including the version constraint
+    b32      private;  // from Requires.private
+};
+
 typedef struct {
-    pkgspec *specs;
-    pkg     *newpkg;
-    i32      depth;
-    i32      flags;
-} procstate;
+    edge  *head;
+    edge **tail;
+} graph;
 
 typedef struct {
     u8buf    *err;
+    graph    *graph;  // if non-null, record walked edges
     search    search;
     env     **global;
     i32       maxdepth;
     b32       define_prefix;
     b32       recursive;
     b32       ignore_versions;
-    procstate stack[256];
+    b32       pristine;  // no user-defined global variables
+    u32       seed;
 } processor;
 
 static processor *newprocessor(config *c, u8buf *err, env **g)
@@ -1446,29 +2463,20 @@ static processor *newprocessor(config *c, u8buf *err, env **g)
     proc->maxdepth = (u32)-1 >> 1;
     proc->define_prefix = 1;
     proc->recursive = 1;
+    proc->seed = c->seed;
     return proc;
 }
 
-static void setprefix(pkg *p, arena *perm)
+static void setprefix(pcfile *p, arena *perm)
 {
     s8 parent = dirname(p->path);
     if (s8equals(S("pkgconfig"), basename(parent))) {
         s8 prefix = dirname(dirname(parent));
         prefix = s8pathencode(prefix, perm);
-        *insert(&p->env, S("prefix"), perm) = prefix;
+        *insert(&p->env, S("prefix"), p->env->seed, perm) = prefix;
     }
 }
 
-static void failmaxrecurse(u8buf *err, s8 tok)
-{
-    prints8(err, S("pkg-config: "));
-    prints8(err, S("exceeded max recursion depth on '"));
-    prints8(err, tok);
-    prints8(err, S("'\n"));
-    flush(err);
-    os_fail(err->ctx);
-}
-
 static void failversion(u8buf *err, pkg *pkg, versop op, s8 want)
 {
     prints8(err, S("pkg-config: "));
@@ -1479,99 +2487,321 @@ static void failversion(u8buf *err, pkg *pkg, versop op, s8 want)
     prints8(err, S(" '"));
     prints8(err, want);
     prints8(err, S("' but got '"));
-    prints8(err, pkg->version);
+    prints8(err, getfield(pkg, field_VERSION));
     prints8(err, S("'\n"));
     flush(err);
-    os_fail(err->ctx);
+    fail(err->ctx);
+}
+
+// Frames are recycled through a free list, so traversal memory is
+// linear in the depth of the graph, not in the number of visits.
+static procstate *pushstate(procstate **stack, procstate **free, arena *perm)
+{
+    procstate *s = *free;
+    if (s) {
+        *free = s->next;
+        *s = (procstate){0};
+    } else {
+        s = new(perm, procstate, 1);
+    }
+    s->next = *stack;
+    *stack = s;
+    return s;
 }
 
 static pkgs process(processor *proc, pkgspec *specs, arena *perm)
 {
     u8buf *err = proc->err;
-    pkgs pkgs = {0};
+    pkgs pkgs = newpkgs(perm, proc->seed);
     env **global = proc->global;
     search *search = &proc->search;
 
-    procstate *stack = proc->stack;
-    i32 cap = countof(proc->stack);
-    i32 top = 0;
-    stack[0] = (procstate){0};
-    stack[0].specs = specs;
-    stack[0].flags = pkg_DIRECT | pkg_PUBLIC;
-
-    while (top >= 0) {
-        procstate *s = stack + top;
-        if (s->newpkg) {
-            prepend(&pkgs, s->newpkg);
-            s->newpkg = 0;
-        }
-
-        pkgspec *spec = s->specs;
-        if (!spec) {
-            top--;
+    procstate *stack = 0;
+    procstate *free  = 0;
+    procstate *root  = pushstate(&stack, &free, perm);
+    root->public = specs;
+    root->flags  = pkg_DIRECT | pkg_PUBLIC;
+
+    while (stack) {
+        procstate *s = stack;
+        pkgspec *spec = 0;
+        i32 flags = 0;
+        b32 private = 0;
+        if (s->private) {
+            spec = s->private;
+            s->private = spec->next;
+            private = 1;
+        } else if (s->public) {
+            spec = s->public;
+            s->public = spec->next;
+            flags = s->flags;
+        } else {
+            if (s->newpkg) {
+                markloaded(&pkgs, s->newpkg-1);
+            }
+            stack = s->next;
+            s->next = free;
+            free = s;
             continue;
         }
-        s->specs = spec->next;
 
         s8 realname = pathtorealname(spec->name);
         pkg *p = locate(&pkgs, realname, perm);
 
+        // Record edges out of the command line and of freshly loaded
+        // packages, but not those re-walked to propagate pkg_PUBLIC.
+        if (proc->graph && (s->newpkg || !s->depth)) {
+            edge *e = new(perm, edge, 1);
+            if (s->newpkg) {
+                e->from = pkgs.recs[s->newpkg-1].realname;
+            }
+            e->to = p->realname;
+            e->spec = spec;
+            e->private = private;
+            *proc->graph->tail = e;
+            proc->graph->tail = &e->next;
+        }
+
         i32 depth = s->depth + 1;
-        i32 flags = s->flags;
-        if (p->contents.s) {
+        b32 recurse = proc->recursive && depth<proc->maxdepth;
+        if (p->data) {
             if (flags&pkg_PUBLIC && !(p->flags & pkg_PUBLIC)) {
                 // We're on a public branch, but this package was
                 // previously loaded as private. Recursively traverse
                 // its public requires and mark all as public.
                 p->flags |= pkg_PUBLIC;
-                if (proc->recursive && depth<proc->maxdepth) {
-                    if (top >= cap-1) {
-                        failmaxrecurse(err, p->name);
-                    }
-                    top++;
-                    stack[top].specs = p->specs_requires;
-                    stack[top].depth = depth;
-                    stack[top].flags = flags & ~pkg_DIRECT;
+                if (recurse) {
+                    procstate *next = pushstate(&stack, &free, perm);
+                    next->public = p->specs_requires;
+                    next->depth  = depth;
+                    next->flags  = flags & ~pkg_DIRECT;
                 }
             }
 
         } else {
             // Package hasn't been loaded yet, so find and load it.
-            s->newpkg = p;
-            pkg newpkg = findpackage(search, err, spec->name, perm);
+            i32 index = (i32)(p - pkgs.recs);
+            usdt2(load_start, spec->name.s, spec->name.len);
+            i32 phase = enterphase(perm, phase_PARSE);
+            i64 beg = tracebegin(perm->ctx);
+            pcfile newpkg = findpackage(
+                search, err, spec->name, proc->seed, 0, perm
+            );
+            traceend(perm->ctx, S("findpackage"), spec->name, beg);
+            enterphase(perm, phase);
+            tally(packages, 1);
+            logpackage(spec->name);
             if (proc->define_prefix) {
                 setprefix(&newpkg, perm);
             }
-            expandmerge(err, *global, p, &newpkg, perm);
+            snapshotpkg *e = newpkg.embedded;
+            if (e && e->expanded && proc->pristine &&
+                proc->define_prefix==embedded.define_prefix) {
+                embedmerge(err, p, &newpkg, perm);
+            } else {
+                expandmerge(err, *global, p, &newpkg, perm);
+            }
+            usdt2(load_done, p->realname.s, p->realname.len);
 
             if (spec->op && !proc->ignore_versions) {
-                i32 cmp = compareversions(p->version, spec->version);
+                s8 version = getfield(p, field_VERSION);
+                i32 cmp = compareversions(version, spec->version);
                 if (!validcompare(spec->op, cmp)) {
                     failversion(err, p, spec->op, spec->version);
                 }
             }
 
-            if (proc->recursive && depth<proc->maxdepth) {
-                if (top >= cap-2) {
-                    failmaxrecurse(err, p->name);
-                }
-                top++;
-                stack[top].specs = p->specs_requires;
-                stack[top].depth = depth;
-                stack[top].flags = flags & ~pkg_DIRECT;
-
-                top++;
-                stack[top].specs = p->specs_requiresprivate;
-                stack[top].depth = depth;
-                stack[top].flags = 0;
+            if (recurse) {
+                procstate *next = pushstate(&stack, &free, perm);
+                next->private = p->specs_requiresprivate;
+                next->public  = p->specs_requires;
+                next->newpkg  = index + 1;
+                next->depth   = depth;
+                next->flags   = flags & ~pkg_DIRECT;
+            } else {
+                markloaded(&pkgs, index);
             }
         }
         p->flags |= flags;
     }
-    assert(allpresent(pkgs));
+    sortbyload(&pkgs);
     return pkgs;
 }
 
+// Like expand(), but only report whether it would succeed.
+static b32 expandable(env *global, env *env, s8 str)
+{
+    i32 top = 0;
+    s8 stack[128];
+
+    stack[top] = str;
+    while (top >= 0) {
+        s8 s = stack[top--];
+        for (iz i = 0; i < s.len-1; i++) {
+            if (s.s[i]=='$' && s.s[i+1]=='{') {
+                if (top >= countof(stack)-2) {
+                    return 0;
+                }
+                iz beg = i + 2;
+                iz end = beg;
+                for (; end<s.len && s.s[end]!='}'; end++) {}
+                s8 name = s8span(s.s+beg, s.s+end);
+                end += end < s.len;
+                stack[++top] = cuthead(s, end);
+                s8 value = lookup(global, env, name);
+                if (!value.s) {
+                    return 0;
+                }
+                stack[++top] = value;
+                break;
+            } else if (s.s[i]=='$' && s.s[i+1]=='$') {
+                stack[++top] = cuthead(s, i+2);
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+// Like parsespecs(), but only report whether it would succeed.
+static b32 specsok(s8 field)
+{
+    versop op = 0;
+    b32 named = 0;
+    s8pair sp = {0};
+    sp.tail = field;
+    for (;;) {
+        sp = nexttoken(sp.tail);
+        s8 tok = sp.head;
+        if (!tok.len) {
+            break;
+        } else if (!named) {
+            if (parseop(tok)) {
+                return 0;
+            }
+            named = 1;
+        } else if (!op) {
+            op = parseop(tok);
+        } else {
+            op = 0;
+            named = 0;
+        }
+    }
+    return !op;
+}
+
+// Report whether every argument in a field dequotes, as appendfield()
+// requires of the fields it prints.
+static b32 dequotable(s8 field, arena scratch)
+{
+    while (field.len) {
+        dequoted r = dequote(field, &scratch);
+        if (!r.ok) {
+            return 0;
+        }
+        field = r.tail;
+    }
+    return 1;
+}
+
+// Report whether expandmerge() and, later, appendfield() would accept a
+// package rather than fail.
+static b32 loadable(env *global, pcfile *pc, arena scratch)
+{
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        if (!expandable(global, pc->env, pc->fields[i])) {
+            return 0;
+        }
+    }
+
+    static const i32 fields[] = {
+        field_REQUIRES, field_REQUIRESPRIVATE,
+        field_CFLAGS, field_CFLAGSPRIVATE, field_LIBS, field_LIBSPRIVATE,
+    };
+    u8buf *null = newnullout(&scratch);
+    for (i32 i = 0; i < countof(fields); i++) {
+        u8buf mem = newmembuf(&scratch);
+        expand(&mem, null, global, pc->env, pc->path, pc->fields[fields[i]]);
+        s8 value = finalize(&mem);
+        b32 ok = i<2 ? specsok(value) : dequotable(value, scratch);
+        if (!ok) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Check, without failing, that a package and all its requirements load
+// as process() would load them, versions included. Returns the path of
+// the package, valid until the arena is next used, or null when broken.
+static s8 probe(processor *proc, s8 name, arena scratch)
+{
+    u8buf *null = newnullout(&scratch);
+    pkgs seen = newpkgs(&scratch, proc->seed);
+    s8 path = {0};
+
+    pkgspec *root = new(&scratch, pkgspec, 1);
+    root->name = name;
+    procstate *stack = 0;
+    procstate *free  = 0;
+    pushstate(&stack, &free, &scratch)->public = root;
+
+    while (stack) {
+        procstate *s = stack;
+        pkgspec *spec = 0;
+        if (s->private) {
+            spec = s->private;
+            s->private = spec->next;
+        } else if (s->public) {
+            spec = s->public;
+            s->public = spec->next;
+        } else {
+            stack = s->next;
+            s->next = free;
+            free = s;
+            continue;
+        }
+
+        s8 realname = pathtorealname(spec->name);
+        pkg *p = locate(&seen, realname, &scratch);
+        if (p->data) {
+            continue;
+        }
+
+        i32 phase = enterphase(&scratch, phase_PARSE);
+        i64 beg = tracebegin(scratch.ctx);
+        pcfile pc = findpackage(
+            &proc->search, null, spec->name, proc->seed, 1, &scratch
+        );
+        traceend(scratch.ctx, S("findpackage"), spec->name, beg);
+        enterphase(&scratch, phase);
+        if (!pc.path.s) {
+            return (s8){0};
+        }
+        if (proc->define_prefix) {
+            setprefix(&pc, &scratch);
+        }
+        if (!loadable(*proc->global, &pc, scratch)) {
+            return (s8){0};
+        }
+        expandmerge(null, *proc->global, p, &pc, &scratch);
+        path = path.s ? path : pc.path;
+
+        if (spec->op && !proc->ignore_versions) {
+            s8 version = getfield(p, field_VERSION);
+            i32 cmp = compareversions(version, spec->version);
+            if (!validcompare(spec->op, cmp)) {
+                return (s8){0};
+            }
+        }
+
+        procstate *next = pushstate(&stack, &free, &scratch);
+        next->private = p->specs_requiresprivate;
+        next->public  = p->specs_requires;
+    }
+    return path;
+}
+
 typedef enum {
     filter_ANY,
     filter_I,
@@ -1623,35 +2853,25 @@ static void msvcize(u8buf *out, s8 arg)
     }
 }
 
-typedef struct argpos argpos;
-struct argpos {
-    argpos *child[4];
-    argpos *next;
-    s8      arg;
-    iz      position;
-};
+enum { arg_PLAIN, arg_DEDUP, arg_EXCLUDE };
 
 typedef struct {
-    s8list  list;
-    argpos *positions;
-    iz      count;
+    s8  str;
+    i32 id;  // interned identifier, or -1 for plain arguments
+    i32 kind;
+    b32 keep;
+} argtok;
+
+// Arguments in order of appearance. Growth doubles the array, leaving
+// the old copy behind in the (scratch) arena. Dedupable arguments are
+// interned, so duplicates share one copy and compare by identifier.
+typedef struct {
+    argtok *toks;
+    env    *ids;
+    iz      len;
+    iz      cap;
 } args;
 
-static argpos *findargpos(argpos **m, s8 arg, arena *perm)
-{
-    for (u32 h = s8hash(arg); *m; h <<= 2) {
-        if (s8equals((*m)->arg, arg)) {
-            return *m;
-        }
-        m = &(*m)->child[h>>30];
-    }
-    if (perm) {
-        *m = new(perm, argpos, 1);
-        (*m)->arg = arg;
-    }
-    return *m;
-}
-
 static b32 dedupable(s8 arg)
 {
     // Do not count "-I" or "-L" with detached argument
@@ -1669,47 +2889,102 @@ static b32 dedupable(s8 arg)
     return 0;
 }
 
-static void appendarg(args *args, s8 arg, arena *perm)
+// Returns the argument as stored, which is the interned copy for all
+// but plain arguments.
+static s8 pushtoken(args *args, s8 arg, i32 kind, arena *perm)
 {
-    append(&args->list, arg, perm);
-    iz position = args->count++;
-    if (dedupable(arg)) {
-        argpos *n = findargpos(&args->positions, arg, perm);
-        if (!n->position || startswith(arg, S("-l"))) {
-            // Zero position reserved for null, so bias it by 1
-            n->position = 1 + position;
-        }
+    if (args->len == args->cap) {
+        args->cap = args->cap ? args->cap*2 : 64;
+        argtok *toks = new(perm, argtok, args->cap);
+        iz size = args->len * (iz)sizeof(*toks);
+        u8copy((u8 *)toks, (u8 *)args->toks, size);
+        args->toks = toks;
+    }
+    argtok *t = args->toks + args->len++;
+    t->str  = arg;
+    t->id   = -1;
+    t->kind = kind;
+    t->keep = kind==arg_PLAIN;
+    if (kind != arg_PLAIN) {
+        t->id  = intern(&args->ids, arg, args->ids->seed, perm);
+        t->str = args->ids->vars[t->id].name;
     }
+    return t->str;
+}
+
+static s8 appendarg(args *args, s8 arg, arena *perm)
+{
+    i32 kind = dedupable(arg) ? arg_DEDUP : arg_PLAIN;
+    return pushtoken(args, arg, kind, perm);
 }
 
+// Excluded arguments are never printed, and since they're appended
+// ahead of all others, they suppress later duplicates.
 static void excludearg(args *args, s8 arg, arena *perm)
 {
-    argpos *n = findargpos(&args->positions, arg, perm);
-    n->position = -1;  // i.e. position before first argument
+    pushtoken(args, arg, arg_EXCLUDE, perm);
 }
 
-// Is this the correct position for the given argument?
-static b32 inposition(args *args, s8 arg, iz position)
+// Mark the surviving argument of each duplicate set. The first instance
+// wins, except for "-l" where the last instance wins so that libraries
+// are listed after everything that depends on them.
+static void dedup(args *args, arena scratch)
 {
-    argpos *n = findargpos(&args->positions, arg, 0);
-    return !n || n->position==position+1;
+    i32 nids = args->ids ? args->ids->len : 0;
+    iz *winner = new(&scratch, iz, nids);  // argument index + 1
+
+    for (iz i = 0; i < args->len; i++) {
+        argtok *t = args->toks + i;
+        if (t->id<0) {
+            continue;
+        } else if (!winner[t->id] || startswith(t->str, S("-l"))) {
+            winner[t->id] = i + 1;
+        }
+    }
+
+    for (i32 id = 0; id < nids; id++) {
+        argtok *t = args->toks + winner[id] - 1;
+        t->keep = t->kind != arg_EXCLUDE;
+    }
+
+    for (iz i = 0; i < args->len; i++) {
+        argtok *t = args->toks + i;
+        if (t->id>=0 && !t->keep && t->kind!=arg_EXCLUDE) {
+            // Dropped as a duplicate, not as an excluded system path
+            argtok *w = args->toks + winner[t->id] - 1;
+            tally(dedups, w->kind != arg_EXCLUDE);
+        }
+    }
 }
 
+// Output syntax for arguments, which are natively shell-escaped
+typedef enum {
+    syntax_SHELL,
+    syntax_JSON,
+    syntax_MAKE,
+    syntax_NINJA,
+    syntax_SH,
+    syntax_CMAKE,
+} syntax;
+
 typedef struct {
     arena *perm;
     iz    *argcount;
     args   args;
     filter filter;
     b32    msvc;
+    syntax syntax;
     u8     delim;
 } fieldwriter;
 
-static fieldwriter newfieldwriter(filter f, iz *argcount, arena *perm)
+static fieldwriter newfieldwriter(
+    filter f, iz *argcount, u32 seed, arena *perm)
 {
     fieldwriter w = {0};
     w.perm = perm;
     w.filter = f;
     w.argcount = argcount;
+    w.args.ids = newenv(perm, seed);
     return w;
 }
 
@@ -1757,7 +3032,9 @@ static void appendfield(u8buf *err, fieldwriter *w, pkg *p, s8 field)
 {
     arena *perm = w->perm;
     filter f = w->filter;
+    i64 beg = tracebegin(perm->ctx);
     while (field.len) {
+        byte *mark = perm->beg;
         dequoted r = dequote(field, perm);
         if (!r.ok) {
             prints8(err, S("pkg-config: "));
@@ -1765,43 +3042,646 @@ static void appendfield(u8buf *err, fieldwriter *w, pkg *p, s8 field)
             prints8(err, p->realname);
             prints8(err, S("'\n"));
             flush(err);
-            os_fail(err->ctx);
+            fail(err->ctx);
         }
+        s8 arg = {0};
         if (filterok(f, r.arg)) {
-            appendarg(&w->args, r.arg, perm);
+            arg = appendarg(&w->args, r.arg, perm);
+        }
+        if (arg.s != r.arg.s) {
+            // Filtered or a duplicate: release the dequote() copy, which
+            // sits at the low end of the arena.
+            perm->beg = mark;
         }
         field = r.tail;
     }
+    traceend(perm->ctx, S("appendfield"), p->realname, beg);
 }
 
-static void writeargs(u8buf *out, fieldwriter *w)
+// Print a shell-escaped argument in another syntax. Make and Ninja
+// values are still shell words, for use in recipes and commands. JSON
+// and CMake lists hold plain words, so the shell escapes are stripped.
+static void printsyntax(u8buf *b, s8 arg, syntax x, arena scratch)
 {
-    iz position = 0;
-    u8 delim = w->delim ? w->delim : ' ';
-    for (s8node *n = w->args.list.head; n; n = n->next) {
-        s8 arg = n->str;
-        if (inposition(&w->args, arg, position++)) {
-            if ((*w->argcount)++) {
-                printu8(out, delim);
-            }
-            if (w->msvc) {
-                msvcize(out, arg);
-            } else {
-                prints8(out, arg);
+    s8 word = {0};
+    switch (x) {
+    case syntax_SHELL:
+        prints8(b, arg);
+        break;
+
+    case syntax_JSON:
+    case syntax_CMAKE:
+        word = news8(&scratch, arg.len);
+        word.len = 0;
+        for (iz i = 0; i < arg.len; i++) {
+            i += arg.s[i]=='\\' && i+1<arg.len;
+            word.s[word.len++] = arg.s[i];
+        }
+        if (x == syntax_JSON) {
+            printjson(b, word);
+            break;
+        }
+        for (iz i = 0; i < word.len; i++) {  // within a quoted list
+            u8 c = word.s[i];
+            if (c=='\\' || c=='"' || c=='$' || c==';') {
+                printu8(b, '\\');
             }
+            printu8(b, c);
         }
-    }
-}
+        break;
 
-static void list(u8buf *out, u8buf *err, env *g, arena a, s8node *dirs, b32 all)
-{
-    for (s8node *dir = dirs; dir; dir = dir->next) {
-        arena scratch = a;
+    case syntax_MAKE:
+        for (iz i = 0; i < arg.len; i++) {
+            switch (arg.s[i]) {
+            case '$': prints8(b, S("$$"));   break;
+            case '#': prints8(b, S("\\#"));  break;
+            default : printu8(b, arg.s[i]);
+            }
+        }
+        break;
 
-        u8buf buf = newmembuf(&scratch);
-        prints8(&buf, dir->str);
+    case syntax_NINJA:
+        for (iz i = 0; i < arg.len; i++) {
+            if (arg.s[i] == '$') {
+                printu8(b, '$');
+            }
+            printu8(b, arg.s[i]);
+        }
+        break;
+
+    case syntax_SH:  // within single quotes
+        for (iz i = 0; i < arg.len; i++) {
+            if (arg.s[i] == '\'') {
+                prints8(b, S("'\\''"));
+            } else {
+                printu8(b, arg.s[i]);
+            }
+        }
+        break;
+    }
+}
+
+static void writeargs(u8buf *out, fieldwriter *w)
+{
+    i64 beg = tracebegin(out->ctx);
+    u8 delim = w->delim ? w->delim : ' ';
+    dedup(&w->args, *w->perm);
+    for (iz i = 0; i < w->args.len; i++) {
+        argtok *t = w->args.toks + i;
+        if (!t->keep) {
+            continue;
+        }
+
+        if (!(*w->argcount)++) {
+            // first argument, no delimiter
+        } else if (w->syntax == syntax_JSON) {
+            prints8(out, S(", "));
+        } else if (w->syntax == syntax_CMAKE) {
+            printu8(out, ';');
+        } else {
+            printu8(out, delim);
+        }
+
+        arena scratch = *w->perm;
+        s8 arg = t->str;
+        b32 bare = w->filter==filter_I ||
+                   w->filter==filter_L ||
+                   w->filter==filter_l;
+        if (w->syntax==syntax_CMAKE && bare) {
+            arg = cuthead(arg, 2);  // CMake properties take bare values
+        } else if (w->msvc) {
+            u8buf mem = newmembuf(&scratch);
+            msvcize(&mem, arg);
+            arg = finalize(&mem);
+        }
+        printsyntax(out, arg, w->syntax, scratch);
+    }
+    traceend(out->ctx, S("writeargs"), (s8){0}, beg);
+}
+
+// Settings shared by every --cflags and --libs variant
+typedef struct {
+    s8     sys_incpath;  // excluded include paths, null to keep them
+    s8     sys_libpath;  // excluded library paths, null to keep them
+    u32    seed;
+    b32    msvc;
+    b32    static_;
+    syntax syntax;
+    u8     pathdelim;
+    u8     argdelim;
+} flagconf;
+
+static void writecflags(
+    u8buf *out, u8buf *err, flagconf *fc, pkgs *pkgs, filter f,
+    iz *argcount, arena scratch)
+{
+    fieldwriter fw = newfieldwriter(f, argcount, fc->seed, &scratch);
+    fw.delim = fc->argdelim;
+    fw.msvc = fc->msvc;
+    fw.syntax = fc->syntax;
+    if (fc->sys_incpath.s) {
+        insertsyspath(&fw, fc->sys_incpath, fc->pathdelim, 'I');
+    }
+    for (pkg *p = pkgs->recs; p < pkgs->recs+pkgs->count; p++) {
+        appendfield(err, &fw, p, getfield(p, field_CFLAGS));
+        if (fc->static_) {
+            appendfield(err, &fw, p, getfield(p, field_CFLAGSPRIVATE));
+        }
+    }
+    writeargs(out, &fw);
+}
+
+static void writelibs(
+    u8buf *out, u8buf *err, flagconf *fc, pkgs *pkgs, filter f,
+    iz *argcount, arena scratch)
+{
+    fieldwriter fw = newfieldwriter(f, argcount, fc->seed, &scratch);
+    fw.delim = fc->argdelim;
+    fw.msvc = fc->msvc;
+    fw.syntax = fc->syntax;
+    if (fc->sys_libpath.s) {
+        insertsyspath(&fw, fc->sys_libpath, fc->pathdelim, 'L');
+    }
+    for (pkg *p = pkgs->recs; p < pkgs->recs+pkgs->count; p++) {
+        if (fc->static_) {
+            appendfield(err, &fw, p, getfield(p, field_LIBS));
+            appendfield(err, &fw, p, getfield(p, field_LIBSPRIVATE));
+        } else if (p->flags & pkg_PUBLIC) {
+            appendfield(err, &fw, p, getfield(p, field_LIBS));
+        }
+    }
+    writeargs(out, &fw);
+}
+
+// Every output class of a single resolution, one labeled section each,
+// so that a build system need not run a process per class. Arguments
+// follow the label, each preceded by the delimiter, and the section
+// ends with a newline. Each section is exactly the output of its option
+// alone: dedup and system path exclusion apply per section.
+static void writesections(
+    u8buf *out, u8buf *err, flagconf *fc, pkgs *pkgs, arena scratch)
+{
+    static const struct {
+        s8     label;
+        b32    libs;
+        filter filter;
+    } sections[] = {
+        {s8("cflags"),            0, filter_ANY},
+        {s8("cflags-only-I"),     0, filter_I},
+        {s8("cflags-only-other"), 0, filter_OTHERC},
+        {s8("libs"),              1, filter_ANY},
+        {s8("libs-only-L"),       1, filter_L},
+        {s8("libs-only-l"),       1, filter_l},
+        {s8("libs-only-other"),   1, filter_OTHERL},
+    };
+
+    prints8(out, S("modversion"));
+    for (pkg *p = pkgs->recs; p < pkgs->recs+pkgs->count; p++) {
+        if (p->flags & pkg_DIRECT) {
+            printu8(out, fc->argdelim);
+            prints8(out, getfield(p, field_VERSION));
+        }
+    }
+    printu8(out, '\n');
+
+    for (iz i = 0; i < countof(sections); i++) {
+        iz argcount = 1;  // delimit the label, too
+        prints8(out, sections[i].label);
+        if (sections[i].libs) {
+            writelibs(out, err, fc, pkgs, sections[i].filter, &argcount,
+                      scratch);
+        } else {
+            writecflags(out, err, fc, pkgs, sections[i].filter, &argcount,
+                        scratch);
+        }
+        printu8(out, '\n');
+    }
+}
+
+// An INTERFACE IMPORTED target named PkgConfig::NAME for the one package
+// named directly, with its resolved flags split into properties as
+// FindPkgConfig's IMPORTED_TARGET does. Requires CMake 3.13.
+static void writecmake(
+    u8buf *out, u8buf *err, flagconf *fc, pkgs *pkgs, pkg *direct,
+    arena scratch)
+{
+    s8 target = news8(&scratch, direct->realname.len);
+    for (iz i = 0; i < target.len; i++) {
+        u8 c = direct->realname.s[i];
+        b32 ok = digit(c) || (c>='a' && c<='z') || (c>='A' && c<='Z') ||
+                 c=='_' || c=='.' || c=='+' || c=='-';
+        target.s[i] = ok ? c : '_';
+    }
+
+    static const struct {
+        s8     property;
+        b32    libs;
+        filter filter;
+    } props[] = {
+        {s8("INTERFACE_INCLUDE_DIRECTORIES"), 0, filter_I},
+        {s8("INTERFACE_COMPILE_OPTIONS"),     0, filter_OTHERC},
+        {s8("INTERFACE_LINK_DIRECTORIES"),    1, filter_L},
+        {s8("INTERFACE_LINK_LIBRARIES"),      1, filter_l},
+        {s8("INTERFACE_LINK_OPTIONS"),        1, filter_OTHERL},
+    };
+
+    prints8(out, S("# "));
+    prints8(out, direct->realname);
+    printu8(out, ' ');
+    prints8(out, getfield(direct, field_VERSION));
+    prints8(out, S("\nif(NOT TARGET PkgConfig::"));
+    prints8(out, target);
+    prints8(out, S(")\n  add_library(PkgConfig::"));
+    prints8(out, target);
+    prints8(out, S(" INTERFACE IMPORTED)\n"));
+    prints8(out, S("  set_target_properties(PkgConfig::"));
+    prints8(out, target);
+    prints8(out, S(" PROPERTIES\n"));
+    for (iz i = 0; i < countof(props); i++) {
+        iz argcount = 0;
+        prints8(out, S("    "));
+        prints8(out, props[i].property);
+        prints8(out, S(" \""));
+        if (props[i].libs) {
+            writelibs(out, err, fc, pkgs, props[i].filter, &argcount, scratch);
+        } else {
+            writecflags(
+                out, err, fc, pkgs, props[i].filter, &argcount, scratch
+            );
+        }
+        prints8(out, S("\"\n"));
+    }
+    prints8(out, S("  )\nendif()\n"));
+}
+
+// Assignments of PREFIX_CFLAGS, PREFIX_LIBS, and PREFIX_VERSION for the
+// one package named directly, where PREFIX is its name in upper case
+// with anything else replaced by underscores, as in PKG_CHECK_MODULES.
+static void writeemit(
+    u8buf *out, u8buf *err, flagconf *fc, pkgs *pkgs, filter filterc,
+    filter filterl, arena scratch)
+{
+    pkg *direct = 0;
+    for (pkg *p = pkgs->recs; p < pkgs->recs+pkgs->count; p++) {
+        if (p->flags & pkg_DIRECT) {
+            direct = p;
+        }
+    }
+    assert(direct);
+
+    if (fc->syntax == syntax_CMAKE) {
+        writecmake(out, err, fc, pkgs, direct, scratch);
+        return;
+    }
+
+    s8 name = direct->realname;
+    s8 prefix = news8(&scratch, name.len+1);
+    prefix.len = 0;
+    if (digit(name.s[0])) {
+        prefix.s[prefix.len++] = '_';
+    }
+    for (iz i = 0; i < name.len; i++) {
+        u8 c = name.s[i];
+        if (c>='a' && c<='z') {
+            c = (u8)(c - 'a' + 'A');
+        } else if (!digit(c) && (c<'A' || c>'Z')) {
+            c = '_';
+        }
+        prefix.s[prefix.len++] = c;
+    }
+
+    s8 assign = fc->syntax==syntax_SH ? S("='") : S(" = ");
+    s8 end    = fc->syntax==syntax_SH ? S("'\n") : S("\n");
+    iz argcount = 0;
+
+    prints8(out, prefix);
+    prints8(out, S("_CFLAGS"));
+    prints8(out, assign);
+    writecflags(out, err, fc, pkgs, filterc, &argcount, scratch);
+    prints8(out, end);
+
+    argcount = 0;
+    prints8(out, prefix);
+    prints8(out, S("_LIBS"));
+    prints8(out, assign);
+    writelibs(out, err, fc, pkgs, filterl, &argcount, scratch);
+    prints8(out, end);
+
+    prints8(out, prefix);
+    prints8(out, S("_VERSION"));
+    prints8(out, assign);
+    printsyntax(out, getfield(direct, field_VERSION), fc->syntax, scratch);
+    prints8(out, end);
+}
+
+// Names of the packages in a directory, from the snapshot when covered
+static s8node *listnames(s8 dir, arena *perm)
+{
+    i32 d = embeddeddir(dir);
+    if (d >= 0) {
+        s8list names = {0};
+        for (i32 i = 0; i < embedded.npkgs; i++) {
+            if (embedded.pkgs[i].dir == d) {
+                append(&names, embedded.pkgs[i].realname, perm);
+            }
+        }
+        return names.head;
+    }
+
+    u8buf buf = newmembuf(perm);
+    prints8(&buf, dir);
+    printu8(&buf, 0);
+    s8 pathz = finalize(&buf);
+    tally(dirs, 1);
+    s8node *files = os_listing(perm->ctx, perm, pathz);
+    for (s8node *file = files; file; file = file->next) {
+        if (file->str.len > 3) {
+            file->str = cuttail(file->str, 3);  // remove extension
+        }
+    }
+    return files;
+}
+
+// Emit for every package in the search path, each resolved on its own.
+// Packages that fail to load, or are shadowed by a package of the same
+// name in an earlier directory, are skipped.
+static void emitall(
+    u8buf *out, u8buf *err, processor *proc, flagconf *fc, filter filterc,
+    filter filterl, arena a)
+{
+    for (s8node *dir = proc->search.list.head; dir; dir = dir->next) {
+        arena scratch = a;
+        s8node *names = listnames(dir->str, &scratch);
+        for (s8node *name = names; name; name = name->next) {
+            arena temp = scratch;
+            enterphase(&temp, phase_PROCESS);
+            s8 path = probe(proc, name->str, temp);
+            if (!path.s || !s8equals(dirname(path), dir->str)) {
+                continue;
+            }
+            pkgspec spec = {0};
+            spec.name = name->str;
+            pkgs pkgs = process(proc, &spec, &temp);
+            enterphase(&temp, phase_OUTPUT);
+            writeemit(out, err, fc, &pkgs, filterc, filterl, temp);
+        }
+    }
+}
+
+// Print NAME=VALUE lines for a comma-separated list of variables, or for
+// every package variable in definition order when the list is empty.
+static void printvariables(
+    u8buf *out, u8buf *err, env *g, pkg *p, s8 names, arena scratch)
+{
+    env *memo = newenv(&scratch, p->env->seed);
+    for (i32 i = 0; !names.len && i < p->env->len; i++) {
+        s8 name = p->env->vars[i].name;
+        s8 value = expandvar(&memo, err, g, p->env, p->path, name, 0, &scratch);
+        prints8(out, name);
+        printu8(out, '=');
+        prints8(out, value);
+        printu8(out, '\n');
+    }
+    while (names.len) {
+        cut c = s8cut(names, ',');
+        s8 name = c.head;
+        names = c.tail;
+        if (!name.len || !lookup(g, p->env, name).s) {
+            continue;  // like --variable, skip undefined variables
+        }
+        s8 value = expandvar(&memo, err, g, p->env, p->path, name, 0, &scratch);
+        prints8(out, name);
+        printu8(out, '=');
+        prints8(out, value);
+        printu8(out, '\n');
+    }
+}
+
+// Print a value expanded, as a JSON string. Encoded path bytes are not
+// valid UTF-8, so they are decoded first.
+static void printjsonexpand(
+    u8buf *out, u8buf *err, env *g, pkg *p, s8 value, arena scratch)
+{
+    u8buf mem = newmembuf(&scratch);
+    expand(&mem, err, g, p->env, p->path, value);
+    value = finalize(&mem);
+    printjson(out, s8pathdecode(value, &scratch));
+}
+
+// The whole resolution as one JSON document: every loaded package in
+// load order, then the final arguments as arrays.
+static void writejson(
+    u8buf *out, u8buf *err, flagconf *fc, pkgs *pkgs, env *g,
+    s8 variable, filter filterc, filter filterl, arena scratch)
+{
+    prints8(out, S("{\n  \"packages\": ["));
+    for (pkg *p = pkgs->recs; p < pkgs->recs+pkgs->count; p++) {
+        prints8(out, p==pkgs->recs ? S("\n") : S(",\n"));
+        prints8(out, S("    {\n      \"name\": "));
+        printjson(out, p->realname);
+        prints8(out, S(",\n      \"path\": "));
+        printjson(out, p->path);
+        prints8(out, S(",\n      \"version\": "));
+        printjson(out, getfield(p, field_VERSION));
+        prints8(out, S(",\n      \"direct\": "));
+        prints8(out, p->flags&pkg_DIRECT ? S("true") : S("false"));
+        prints8(out, S(",\n      \"public\": "));
+        prints8(out, p->flags&pkg_PUBLIC ? S("true") : S("false"));
+
+        prints8(out, S(",\n      \"fields\": {"));
+        i32 count = 0;
+        for (i32 i = 0; i < PKG_NFIELDS; i++) {
+            assert(fieldkeys[i].id == i);
+            if (p->present & 1<<i) {
+                prints8(out, count++ ? S(",\n        ") : S("\n        "));
+                printjson(out, fieldkeys[i].name);
+                prints8(out, S(": "));
+                arena temp = scratch;
+                printjson(out, s8pathdecode(getfield(p, i), &temp));
+            }
+        }
+        prints8(out, count ? S("\n      }") : S("}"));
+
+        prints8(out, S(",\n      \"variables\": {"));
+        s8 value = variable.s ? lookup(g, p->env, variable) : (s8){0};
+        if (value.s) {
+            prints8(out, S("\n        "));
+            printjson(out, variable);
+            prints8(out, S(": "));
+            printjsonexpand(out, err, g, p, value, scratch);
+            prints8(out, S("\n      }"));
+        } else {
+            prints8(out, S("}"));
+        }
+        prints8(out, S("\n    }"));
+    }
+    prints8(out, pkgs->count ? S("\n  ],\n") : S("],\n"));
+
+    iz argcount = 0;
+    prints8(out, S("  \"cflags\": ["));
+    writecflags(out, err, fc, pkgs, filterc, &argcount, scratch);
+    argcount = 0;
+    prints8(out, S("],\n  \"libs\": ["));
+    writelibs(out, err, fc, pkgs, filterl, &argcount, scratch);
+    prints8(out, S("]\n}\n"));
+}
+
+// Print escaped for a quoted Graphviz ID
+static void printdot(u8buf *b, s8 s)
+{
+    for (iz i = 0; i < s.len; i++) {
+        if (s.s[i]=='"' || s.s[i]=='\\') {
+            printu8(b, '\\');
+        }
+        printu8(b, s.s[i]);
+    }
+}
+
+// Packages reached only through Requires.private are dashed, and those
+// named directly get a double border. Requires.private edges are dashed,
+// and edges carry their version constraint as a label.
+static void writedot(u8buf *out, pkgs *pkgs, graph *g)
+{
+    prints8(out, S("digraph \"pkg-config\" {\n"));
+    for (pkg *p = pkgs->recs; p < pkgs->recs+pkgs->count; p++) {
+        prints8(out, S("  \""));
+        printdot(out, p->realname);
+        prints8(out, S("\" [label=\""));
+        printdot(out, p->realname);
+        s8 version = getfield(p, field_VERSION);
+        if (version.len) {
+            printu8(out, ' ');
+            printdot(out, version);
+        }
+        printu8(out, '"');
+        if (p->flags & pkg_DIRECT) {
+            prints8(out, S(", peripheries=2"));
+        }
+        if (!(p->flags & pkg_PUBLIC)) {
+            prints8(out, S(", style=dashed"));
+        }
+        prints8(out, S("]\n"));
+    }
+    for (edge *e = g->head; e; e = e->next) {
+        if (!e->from.s) {
+            continue;  // shown by peripheries
+        }
+        prints8(out, S("  \""));
+        printdot(out, e->from);
+        prints8(out, S("\" -> \""));
+        printdot(out, e->to);
+        printu8(out, '"');
+        if (e->private || e->spec->op) {
+            prints8(out, S(" ["));
+            if (e->private) {
+                prints8(out, S("style=dashed"));
+            }
+            if (e->private && e->spec->op) {
+                prints8(out, S(", "));
+            }
+            if (e->spec->op) {
+                prints8(out, S("label=\""));
+                prints8(out, opname(e->spec->op));
+                printu8(out, ' ');
+                printdot(out, e->spec->version);
+                printu8(out, '"');
+            }
+            printu8(out, ']');
+        }
+        printu8(out, '\n');
+    }
+    prints8(out, S("}\n"));
+}
+
+static void writegraphjson(u8buf *out, pkgs *pkgs, graph *g)
+{
+    prints8(out, S("{\n  \"nodes\": ["));
+    for (pkg *p = pkgs->recs; p < pkgs->recs+pkgs->count; p++) {
+        prints8(out, p==pkgs->recs ? S("\n    ") : S(",\n    "));
+        prints8(out, S("{\"name\": "));
+        printjson(out, p->realname);
+        prints8(out, S(", \"version\": "));
+        printjson(out, getfield(p, field_VERSION));
+        prints8(out, S(", \"direct\": "));
+        prints8(out, p->flags&pkg_DIRECT ? S("true") : S("false"));
+        prints8(out, S(", \"public\": "));
+        prints8(out, p->flags&pkg_PUBLIC ? S("true") : S("false"));
+        printu8(out, '}');
+    }
+    prints8(out, pkgs->count ? S("\n  ],\n") : S("],\n"));
+
+    prints8(out, S("  \"edges\": ["));
+    for (edge *e = g->head; e; e = e->next) {
+        prints8(out, e==g->head ? S("\n    ") : S(",\n    "));
+        prints8(out, S("{\"from\": "));
+        if (e->from.s) {
+            printjson(out, e->from);
+        } else {
+            prints8(out, S("null"));
+        }
+        prints8(out, S(", \"to\": "));
+        printjson(out, e->to);
+        prints8(out, S(", \"private\": "));
+        prints8(out, e->private ? S("true") : S("false"));
+        prints8(out, S(", \"constraint\": "));
+        if (e->spec->op) {
+            prints8(out, S("{\"op\": "));
+            printjson(out, opname(e->spec->op));
+            prints8(out, S(", \"version\": "));
+            printjson(out, e->spec->version);
+            printu8(out, '}');
+        } else {
+            prints8(out, S("null"));
+        }
+        printu8(out, '}');
+    }
+    prints8(out, g->head ? S("\n  ]\n}\n") : S("]\n}\n"));
+}
+
+static void listpkg(
+    u8buf *out, u8buf *err, env *g, s8 name, pcfile *pc, b32 all)
+{
+    prints8(out, name);
+    if (all) {
+        // NOTE: pkgconf does not correctly format Unicode names
+        // in this 30-column field, so we won't either.
+        for (iz i = name.len; i < 30; i++) {
+            printu8(out, ' ');
+        }
+        printu8(out, ' ');
+        s8 *fields = pc->fields;
+        expand(out, err, g, pc->env, pc->path, fields[field_NAME]);
+        prints8(out, S(" - "));
+        s8 desc = fields[field_DESCRIPTION];
+        expand(out, err, g, pc->env, pc->path, desc);
+    }
+    printu8(out, '\n');
+}
+
+static void list(
+    u8buf *out, u8buf *err, env *g, arena a, s8node *dirs, b32 all, u32 seed)
+{
+    for (s8node *dir = dirs; dir; dir = dir->next) {
+        arena scratch = a;
+
+        i32 d = embeddeddir(dir->str);
+        if (d >= 0) {
+            for (i32 i = 0; i < embedded.npkgs; i++) {
+                arena temp = scratch;
+                snapshotpkg *e = embedded.pkgs + i;
+                if (e->dir == d) {
+                    parseresult r = unpack(e, seed, &temp);
+                    listpkg(out, err, g, e->realname, &r.pc, all);
+                }
+            }
+            continue;
+        }
+
+        u8buf buf = newmembuf(&scratch);
+        prints8(&buf, dir->str);
         printu8(&buf, 0);
         s8 pathz = finalize(&buf);
+        tally(dirs, 1);
         s8node *files = os_listing(a.ctx, &scratch, pathz);
 
         for (s8node *file = files; file; file = file->next) {
@@ -1813,32 +3693,230 @@ static void list(u8buf *out, u8buf *err, env *g, arena a, s8node *dirs, b32 all)
             }
             s8 path = buildpath(dir->str, name, &temp);
 
+            i32 phase = enterphase(&temp, phase_PARSE);
+            tally(opens, 1);
             filemap m = os_mapfile(a.ctx, &temp, path);
             if (m.status != filemap_OK) {
+                tally(openfails, 1);
+                enterphase(&temp, phase);
                 continue;
             }
+            tally(files, 1);
+            tally(bytes, m.data.len);
 
-            parseresult r = parsepackage(m.data, &temp);
+            i64 beg = tracebegin(a.ctx);
+            parseresult r = parsepackage(m.data, seed, &temp);
+            traceend(a.ctx, S("parsepackage"), name, beg);
+            enterphase(&temp, phase);
             if (r.err != parse_OK) {
                 continue;
             }
+            tally(packages, 1);
+            listpkg(out, err, g, name, &r.pc, all);
+        }
+    }
+}
 
-            prints8(out, name);
-            if (all) {
-                // NOTE: pkgconf does not correctly format Unicode names
-                // in this 30-column field, so we won't either.
-                for (iz i = name.len; i < 30; i++) {
-                    printu8(out, ' ');
-                }
-                printu8(out, ' ');
-                expand(out, err, g, &r.pkg, r.pkg.name);
-                prints8(out, S(" - "));
-                expand(out, err, g, &r.pkg, r.pkg.description);
+#ifdef UCONFIG_INSTRUMENT
+typedef struct {
+    s8  key;      // environment hash and arguments
+    s8  command;
+    i32 count;
+    i64 time;
+    i64 first;    // time of the first run
+} logquery;
+
+typedef struct {
+    s8  command;
+    s8  status;
+    i64 time;
+} logrecord;
+
+enum { logsummary_TOP = 10 };
+
+static i64 parsei64(s8 s)
+{
+    i64 v = 0;
+    for (iz i = 0; i<s.len && digit(s.s[i]); i++) {
+        v = v*10 + s.s[i] - '0';
+    }
+    return v;
+}
+
+// Summarize a $PKG_CONFIG_LOG: totals, then the most repeated queries,
+// i.e. what a cache would have saved, and then the slowest runs.
+// Queries are identical when both arguments and environment match.
+static void summarizelog(u8buf *out, u8buf *err, s8 path, arena *perm)
+{
+    filemap map = os_mapfile(perm->ctx, perm, path);
+    if (map.status != filemap_OK) {
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("could not read log '"));
+        prints8(err, takehead(path, path.len-1));
+        prints8(err, S("'\n"));
+        flush(err);
+        fail(err->ctx);
+    }
+    s8 log = map.data;
+
+    iz nlines = 0;
+    for (iz i = 0; i < log.len; i++) {
+        nlines += log.s[i] == '\n';
+    }
+    i32 exp = 1;
+    for (; ((iz)1<<exp) < 2*nlines; exp++) {}
+    i32      *slots   = new(perm, i32, (iz)1<<exp);
+    logquery *queries = new(perm, logquery, nlines);
+    i32       nqueries = 0;
+
+    logrecord slowest[logsummary_TOP] = {0};
+    i32 nslowest = 0;
+    i64 runs = 0;
+    i64 failures = 0;
+    i64 time = 0;
+    i64 written = 0;
+    i64 files = 0;
+
+    for (cut line = {0}; (line = s8cut(log, '\n')).ok; log = line.tail) {
+        s8 fields[8] = {0};
+        cut f = {0};
+        f.tail = line.head;
+        i32 nfields = 0;
+        for (; nfields < countof(fields)-1; nfields++) {
+            f = s8cut(f.tail, '\t');
+            if (!f.ok) break;
+            fields[nfields] = f.head;
+        }
+        if (nfields != countof(fields)-1) {
+            continue;  // malformed or truncated record
+        }
+        fields[nfields] = f.tail;
+
+        logrecord r = {0};
+        r.time = parsei64(fields[0]);
+        r.status = fields[1];
+        r.command = fields[7];
+        runs++;
+        failures += !s8equals(r.status, S("0"));
+        time += r.time;
+        written += parsei64(fields[2]);
+        files += parsei64(fields[4]);
+
+        // Fields from the environment hash onward are contiguous
+        s8 key = s8span(fields[5].s, line.head.s+line.head.len);
+        u32 hash = s8hash(key, 0);
+        u32 mask = ((u32)1<<exp) - 1;
+        for (u32 i = hash>>(32 - exp);; i = (i + 1) & mask) {
+            if (!slots[i]) {
+                logquery *q = queries + nqueries++;
+                q->key = key;
+                q->command = r.command;
+                q->count = 1;
+                q->time = r.time;
+                q->first = r.time;
+                slots[i] = nqueries;
+                break;
+            }
+            logquery *q = queries + slots[i] - 1;
+            if (s8equals(q->key, key)) {
+                q->count++;
+                q->time += r.time;
+                break;
             }
-            printu8(out, '\n');
         }
+
+        i32 j = nslowest<countof(slowest) ? nslowest++ : countof(slowest);
+        for (; j>0 && slowest[j-1].time<r.time; j--) {
+            if (j < countof(slowest)) {
+                slowest[j] = slowest[j-1];
+            }
+        }
+        if (j < countof(slowest)) {
+            slowest[j] = r;
+        }
+    }
+
+    // Repeats are the runs after the first of each query
+    logquery repeated[logsummary_TOP] = {0};
+    i32 nrepeated = 0;
+    i64 repeats = 0;
+    i64 repeattime = 0;
+    for (i32 i = 0; i < nqueries; i++) {
+        logquery q = queries[i];
+        if (q.count < 2) {
+            continue;
+        }
+        repeats += q.count - 1;
+        repeattime += q.time - q.first;
+        i32 j = nrepeated<countof(repeated) ? nrepeated++ : countof(repeated);
+        for (; j>0 && repeated[j-1].count<q.count; j--) {
+            if (j < countof(repeated)) {
+                repeated[j] = repeated[j-1];
+            }
+        }
+        if (j < countof(repeated)) {
+            repeated[j] = q;
+        }
+    }
+
+    struct {
+        s8  label;
+        i64 value;
+    } rows[] = {
+        {S("invocations"),      runs},
+        {S("failures"),         failures},
+        {S("distinct queries"), nqueries},
+        {S("repeated queries"), repeats},
+        {S("total time"),       time},
+        {S("repeated time"),    repeattime},
+        {S("files read"),       files},
+        {S("bytes output"),     written},
+    };
+    prints8(out, S("pkg-config: log summary\n"));
+    for (iz i = 0; i < countof(rows); i++) {
+        prints8(out, S("  "));
+        prints8(out, rows[i].label);
+        prints8(out, S(": "));
+        printi64(out, rows[i].value);
+        prints8(out, i==4 || i==5 ? S(" us\n") : S("\n"));
     }
+
+    prints8(out, S("most repeated (runs, total us, arguments):\n"));
+    for (i32 i = 0; i < nrepeated; i++) {
+        prints8(out, S("  "));
+        printi64(out, repeated[i].count);
+        printu8(out, '\t');
+        printi64(out, repeated[i].time);
+        printu8(out, '\t');
+        prints8(out, repeated[i].command);
+        printu8(out, '\n');
+    }
+
+    prints8(out, S("slowest (us, status, arguments):\n"));
+    for (i32 i = 0; i < nslowest; i++) {
+        prints8(out, S("  "));
+        printi64(out, slowest[i].time);
+        printu8(out, '\t');
+        prints8(out, slowest[i].status);
+        printu8(out, '\t');
+        prints8(out, slowest[i].command);
+        printu8(out, '\n');
+    }
+    flush(out);
+}
+#endif
+
+#ifndef UCONFIG_INSTRUMENT
+static void uninstrumented(u8buf *err, s8 option)
+{
+    prints8(err, S("pkg-config: "));
+    prints8(err, S("option -"));
+    prints8(err, option);
+    prints8(err, S(" requires a build with UCONFIG_INSTRUMENT\n"));
+    flush(err);
+    fail(err->ctx);
 }
+#endif
 
 static i32 parseuint(s8 s, i32 hi)
 {
@@ -1855,11 +3933,91 @@ static i32 parseuint(s8 s, i32 hi)
     return v;
 }
 
-static void uconfig(config *conf)
+typedef enum {
+    opt_UNKNOWN, opt_HELP, opt_VERSION, opt_MODVERSION,
+    opt_DEFINEPREFIX, opt_DONTDEFINEPREFIX, opt_CFLAGS, opt_LIBS,
+    opt_VARIABLE, opt_STATIC, opt_LIBSONLY_L, opt_LIBSONLY_l,
+    opt_LIBSONLYOTHER, opt_CFLAGSONLY_I, opt_CFLAGSONLYOTHER,
+    opt_WITHPATH, opt_MAXDEPTH, opt_MSVC, opt_DEFINEVARIABLE,
+    opt_NEWLINES, opt_EXISTS, opt_ATLEASTPKGCONFIG, opt_ATLEAST,
+    opt_EXACT, opt_MAX, opt_SILENCE, opt_ERRSTDOUT, opt_PRINTERRORS,
+    opt_SHORTERRORS, opt_UNINSTALLED, opt_KEEPSYSCFLAGS,
+    opt_KEEPSYSLIBS, opt_VALIDATE, opt_LISTALL, opt_LISTNAMES,
+    opt_SECTIONS, opt_JSON, opt_PRINTGRAPH, opt_EMIT, opt_VARIABLES,
+    opt_PRINTVARIABLES, opt_STATS, opt_LOGSUMMARY,
+} option;
+
+static const keyword optionkeys[] = {
+    {s8("h"),                          opt_HELP},
+    {s8("-help"),                      opt_HELP},
+    {s8("-version"),                   opt_VERSION},
+    {s8("-modversion"),                opt_MODVERSION},
+    {s8("-define-prefix"),             opt_DEFINEPREFIX},
+    {s8("-dont-define-prefix"),        opt_DONTDEFINEPREFIX},
+    {s8("-cflags"),                    opt_CFLAGS},
+    {s8("-libs"),                      opt_LIBS},
+    {s8("-variable"),                  opt_VARIABLE},
+    {s8("-static"),                    opt_STATIC},
+    {s8("-libs-only-L"),               opt_LIBSONLY_L},
+    {s8("-libs-only-l"),               opt_LIBSONLY_l},
+    {s8("-libs-only-other"),           opt_LIBSONLYOTHER},
+    {s8("-cflags-only-I"),             opt_CFLAGSONLY_I},
+    {s8("-cflags-only-other"),         opt_CFLAGSONLYOTHER},
+    {s8("-with-path"),                 opt_WITHPATH},
+    {s8("-maximum-traverse-depth"),    opt_MAXDEPTH},
+    {s8("-msvc-syntax"),               opt_MSVC},
+    {s8("-define-variable"),           opt_DEFINEVARIABLE},
+    {s8("-newlines"),                  opt_NEWLINES},
+    {s8("-exists"),                    opt_EXISTS},
+    {s8("-atleast-pkgconfig-version"), opt_ATLEASTPKGCONFIG},
+    {s8("-atleast-version"),           opt_ATLEAST},
+    {s8("-exact-version"),             opt_EXACT},
+    {s8("-max-version"),               opt_MAX},
+    {s8("-silence-errors"),            opt_SILENCE},
+    {s8("-errors-to-stdout"),          opt_ERRSTDOUT},
+    {s8("-print-errors"),              opt_PRINTERRORS},
+    {s8("-short-errors"),              opt_SHORTERRORS},
+    {s8("-uninstalled"),               opt_UNINSTALLED},
+    {s8("-keep-system-cflags"),        opt_KEEPSYSCFLAGS},
+    {s8("-keep-system-libs"),          opt_KEEPSYSLIBS},
+    {s8("-validate"),                  opt_VALIDATE},
+    {s8("-list-all"),                  opt_LISTALL},
+    {s8("-list-package-names"),        opt_LISTNAMES},
+    {s8("-sections"),                  opt_SECTIONS},
+    {s8("-json"),                      opt_JSON},
+    {s8("-print-graph"),               opt_PRINTGRAPH},
+    {s8("-emit"),                      opt_EMIT},
+    {s8("-variables"),                 opt_VARIABLES},
+    {s8("-print-variables"),           opt_PRINTVARIABLES},
+    {s8("-stats"),                     opt_STATS},
+    {s8("-log-summary"),               opt_LOGSUMMARY},
+};
+
+static const u8 optionslots[1<<7] = {
+     0, 41,  0, 10, 43, 28,  0, 42, 18,  0,  0,  0,  0, 22,  0,  0,
+     0,  0,  0, 29,  0,  0,  1,  0,  0,  0,  0,  0, 12,  0,  4,  0,
+     0,  0,  0,  0,  0,  0,  0, 13,  0, 37,  0,  0, 11,  0,  0,  0,
+     0,  0,  0,  0,  2,  0,  0,  0, 26,  0, 34, 36,  0,  0,  0,  0,
+     0, 21, 24,  9,  0, 32,  0, 27,  0,  7,  0, 19,  0, 23,  0,  6,
+     0,  0, 25, 38,  0,  0,  0,  3,  0,  0,  0,  0,  0, 15,  8,  0,
+    33,  0,  0,  0, 35,  0, 14,  5,  0,  0,  0,  0,  0, 16,  0,  0,
+     0,  0, 20, 31,  0,  0,  0,  0,  0,  0,  0, 39, 30, 17, 40,  0,
+};
+
+static const keywords optiontable = {
+    optionkeys, optionslots, countof(optionkeys), 7, 0x740
+};
+
+static option optionbyname(s8 name)
+{
+    return keywordid(&optiontable, name, opt_UNKNOWN);
+}
+
+static void execute(config *conf)
 {
     arena *perm = &conf->perm;
 
-    env *global = 0;
+    env *global = newenv(perm, conf->seed);
     filter filterc = filter_ANY;
     filter filterl = filter_ANY;
     u8buf *out = newfdbuf(perm, 1, 1<<12);
@@ -1875,11 +4033,18 @@ static void uconfig(config *conf)
     b32 static_ = 0;
     u8 argdelim = ' ';
     b32 modversion = 0;
+    b32 sections = 0;
+    b32 json = 0;
+    syntax emit = syntax_SHELL;  // i.e. not emitting
+    enum { graph_NONE, graph_DOT, graph_JSON };
+    i32 graphfmt = graph_NONE;
     versop override_op = versop_ERR;
     s8 override_version = {0};
     b32 print_sysinc = !!conf->print_sysinc.s;
     b32 print_syslib = !!conf->print_syslib.s;
     s8 variable = {0};
+    s8 variables = {0};
+    b32 print_variables = 0;
 
     enum { list_NONE, list_ALL, list_NAMES };
     i32 listing = list_NONE;
@@ -1892,11 +4057,14 @@ static void uconfig(config *conf)
         top_builddir = S("$(top_builddir)");
     }
 
-    *insert(&global, S("pc_path"), perm) = conf->pc_path;
-    *insert(&global, S("pc_system_includedirs"), perm) = conf->pc_sysincpath;
-    *insert(&global, S("pc_system_libdirs"), perm) = conf->pc_syslibpath;
-    *insert(&global, S("pc_sysrootdir"), perm) = S("/");
-    *insert(&global, S("pc_top_builddir"), perm) = top_builddir;
+    u32 seed = conf->seed;
+    *insert(&global, S("pc_path"), seed, perm) = conf->pc_path;
+    *insert(&global, S("pc_system_includedirs"), seed, perm) =
+        conf->pc_sysincpath;
+    *insert(&global, S("pc_system_libdirs"), seed, perm) = conf->pc_syslibpath;
+    *insert(&global, S("pc_sysrootdir"), seed, perm) = S("/");
+    *insert(&global, S("pc_top_builddir"), seed, perm) = top_builddir;
+    i32 nbuiltins = global->len;
 
     s8 *origargs = new(perm, s8, conf->nargs);
     for (i32 i = 0; i < conf->nargs; i++) {
@@ -1914,81 +4082,143 @@ static void uconfig(config *conf)
 
         if (!r.isoption) {
             args[nargs++] = r.arg;
+            continue;
+        }
 
-        } else if (s8equals(r.arg, S("h")) || s8equals(r.arg, S("-help"))) {
+        switch (optionbyname(r.arg)) {
+        case opt_HELP:
             usage(out);
             flush(out);
             return;
 
-        } else if (s8equals(r.arg, S("-version"))) {
+        case opt_VERSION:
             prints8(out, S(VERSION));
             printu8(out, '\n');
             flush(out);
             return;
 
-        } else if (s8equals(r.arg, S("-modversion"))) {
+        case opt_MODVERSION:
             modversion = 1;
             proc->recursive = 0;
+            break;
 
-        } else if (s8equals(r.arg, S("-define-prefix"))) {
+        case opt_DEFINEPREFIX:
             proc->define_prefix = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-dont-define-prefix"))) {
+        case opt_DONTDEFINEPREFIX:
             proc->define_prefix = 0;
+            break;
 
-        } else if (s8equals(r.arg, S("-cflags"))) {
+        case opt_CFLAGS:
             cflags = 1;
             filterc = filter_ANY;
+            break;
 
-        } else if (s8equals(r.arg, S("-libs"))) {
+        case opt_LIBS:
             libs = 1;
             filterl = filter_ANY;
+            break;
 
-        } else if (s8equals(r.arg, S("-variable"))) {
+        case opt_VARIABLE:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
             variable = r.value;
+            break;
+
+        case opt_VARIABLES:
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            variables = r.value;
+            break;
+
+        case opt_PRINTVARIABLES:
+            print_variables = 1;
+            break;
+
+        case opt_STATS:
+            #ifdef UCONFIG_INSTRUMENT
+            if (!counters.enabled) {
+                counters.enabled = 1;
+                counters.mark = os_now(perm->ctx);
+                counters.entry = counters.floor = perm->end - perm->beg;
+            }
+            #else
+            uninstrumented(err, r.arg);
+            #endif
+            break;
+
+        case opt_LOGSUMMARY:
+            #ifdef UCONFIG_INSTRUMENT
+            invocation.path = (s8){0};  // do not log the summary itself
+            if (r.value.s) {
+                u8buf mem = newmembuf(perm);
+                prints8(&mem, r.value);
+                printu8(&mem, 0);
+                conf->logfile = finalize(&mem);
+            } else if (!conf->logfile.s) {
+                prints8(err, S("pkg-config: "));
+                prints8(err, S("--log-summary requires a file or $PKG_CONFIG_LOG\n"));
+                flush(err);
+                fail(err->ctx);
+            }
+            summarizelog(out, err, conf->logfile, perm);
+            return;
+            #else
+            uninstrumented(err, r.arg);
+            #endif
+            break;
 
-        } else if (s8equals(r.arg, S("-static"))) {
+        case opt_STATIC:
             static_ = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-libs-only-L"))) {
+        case opt_LIBSONLY_L:
             libs = 1;
             filterl = filter_L;
+            break;
 
-        } else if (s8equals(r.arg, S("-libs-only-l"))) {
+        case opt_LIBSONLY_l:
             libs = 1;
             filterl = filter_l;
+            break;
 
-        } else if (s8equals(r.arg, S("-libs-only-other"))) {
+        case opt_LIBSONLYOTHER:
             libs = 1;
             filterl = filter_OTHERL;
+            break;
 
-        } else if (s8equals(r.arg, S("-cflags-only-I"))) {
+        case opt_CFLAGSONLY_I:
             cflags = 1;
             filterc = filter_I;
+            break;
 
-        } else if (s8equals(r.arg, S("-cflags-only-other"))) {
+        case opt_CFLAGSONLYOTHER:
             cflags = 1;
             filterc = filter_OTHERC;
+            break;
 
-        } else if (s8equals(r.arg, S("-with-path"))) {
+        case opt_WITHPATH:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
             prependpath(&proc->search, r.value, perm);
+            break;
 
-        } else if (s8equals(r.arg, S("-maximum-traverse-depth"))) {
+        case opt_MAXDEPTH:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
             proc->maxdepth = parseuint(r.value, 1000);
+            break;
 
-        } else if (s8equals(r.arg, S("-msvc-syntax"))) {
+        case opt_MSVC:
             msvc = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-define-variable"))) {
+        case opt_DEFINEVARIABLE:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
@@ -1999,24 +4229,79 @@ static void uconfig(config *conf)
                 prints8(err, r.value);
                 prints8(err, S("'\n"));
                 flush(err);
-                os_fail(err->ctx);
+                fail(err->ctx);
             }
-            *insert(&global, c.head, perm) = c.tail;
+            *insert(&global, c.head, seed, perm) = c.tail;
+            break;
 
-        } else if (s8equals(r.arg, S("-newlines"))) {
+        case opt_NEWLINES:
             argdelim = '\n';
+            break;
+
+        case opt_SECTIONS:
+            sections = 1;
+            break;
+
+        case opt_JSON:
+            json = 1;
+            break;
+
+        case opt_EMIT:
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            if (s8equals(r.value, S("make"))) {
+                emit = syntax_MAKE;
+            } else if (s8equals(r.value, S("ninja"))) {
+                emit = syntax_NINJA;
+            } else if (s8equals(r.value, S("sh"))) {
+                emit = syntax_SH;
+            } else if (s8equals(r.value, S("cmake"))) {
+                emit = syntax_CMAKE;
+            } else {
+                prints8(err, S("pkg-config: "));
+                prints8(err, S("unknown emit format '"));
+                prints8(err, r.value);
+                prints8(err, S("', expected make, ninja, sh, or cmake\n"));
+                flush(err);
+                fail(err->ctx);
+            }
+            break;
+
+        case opt_PRINTGRAPH:
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            if (s8equals(r.value, S("dot"))) {
+                graphfmt = graph_DOT;
+            } else if (s8equals(r.value, S("json"))) {
+                graphfmt = graph_JSON;
+            } else {
+                prints8(err, S("pkg-config: "));
+                prints8(err, S("unknown graph format '"));
+                prints8(err, r.value);
+                prints8(err, S("', expected dot or json\n"));
+                flush(err);
+                fail(err->ctx);
+            }
+            if (!proc->graph) {
+                proc->graph = new(perm, graph, 1);
+                proc->graph->tail = &proc->graph->head;
+            }
+            break;
 
-        } else if (s8equals(r.arg, S("-exists"))) {
+        case opt_EXISTS:
             // The check already happens, just disable the messages
             silent = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-atleast-pkgconfig-version"))) {
+        case opt_ATLEASTPKGCONFIG:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
             return;  // always succeeds
 
-        } else if (s8equals(r.arg, S("-atleast-version"))) {
+        case opt_ATLEAST:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
@@ -2025,8 +4310,9 @@ static void uconfig(config *conf)
             silent = 1;
             proc->recursive = 0;
             proc->ignore_versions = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-exact-version"))) {
+        case opt_EXACT:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
@@ -2035,8 +4321,9 @@ static void uconfig(config *conf)
             silent = 1;
             proc->recursive = 0;
             proc->ignore_versions = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-max-version"))) {
+        case opt_MAX:
             if (!r.value.s) {
                 r.value = getargopt(err, &opts, r.arg);
             }
@@ -2045,60 +4332,74 @@ static void uconfig(config *conf)
             silent = 1;
             proc->recursive = 0;
             proc->ignore_versions = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-silence-errors"))) {
+        case opt_SILENCE:
             silent = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-errors-to-stdout"))) {
+        case opt_ERRSTDOUT:
             err_to_stdout = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-print-errors"))) {
+        case opt_PRINTERRORS:
             // Ignore
+            break;
 
-        } else if (s8equals(r.arg, S("-short-errors"))) {
+        case opt_SHORTERRORS:
             // Ignore
+            break;
 
-        } else if (s8equals(r.arg, S("-uninstalled"))) {
+        case opt_UNINSTALLED:
             // Ignore
+            break;
 
-        } else if (s8equals(r.arg, S("-keep-system-cflags"))) {
+        case opt_KEEPSYSCFLAGS:
             print_sysinc = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-keep-system-libs"))) {
+        case opt_KEEPSYSLIBS:
             print_syslib = 1;
+            break;
 
-        } else if (s8equals(r.arg, S("-validate"))) {
+        case opt_VALIDATE:
             silent = 1;
             proc->recursive = 0;
+            break;
 
-        } else if (s8equals(r.arg, S("-list-all"))) {
+        case opt_LISTALL:
             if (!conf->haslisting) {
                 prints8(err, S("pkg-config: "));
                 prints8(err, S("--list-all is unimplemented\n"));
                 flush(err);
-                os_fail(err->ctx);
+                fail(err->ctx);
             }
             listing = list_ALL;
+            break;
 
-        } else if (s8equals(r.arg, S("-list-package-names"))) {
+        case opt_LISTNAMES:
             if (!conf->haslisting) {
                 prints8(err, S("pkg-config: "));
                 prints8(err, S("--list-package-names is unimplemented\n"));
                 flush(err);
-                os_fail(err->ctx);
+                fail(err->ctx);
             }
             listing = list_NAMES;
+            break;
 
-        } else {
+        case opt_UNKNOWN:
             prints8(err, S("pkg-config: "));
             prints8(err, S("unknown option -"));
             prints8(err, r.arg);
             prints8(err, S("\n"));
             flush(err);
-            os_fail(err->ctx);
+            fail(err->ctx);
         }
     }
 
+    // Pre-expanded embedded fields hold unless the user defined variables
+    proc->pristine = global->len == nbuiltins;
+
     if (err_to_stdout) {
         proc->err = err = out;
     }
@@ -2107,88 +4408,150 @@ static void uconfig(config *conf)
         proc->err = err = newnullout(perm);
     }
 
-    if (listing) {
+    flagconf fc = {0};
+    fc.sys_incpath = print_sysinc ? (s8){0} : conf->sys_incpath;
+    fc.sys_libpath = print_syslib ? (s8){0} : conf->sys_libpath;
+    fc.seed = conf->seed;
+    fc.msvc = msvc;
+    fc.static_ = static_;
+    fc.syntax = json ? syntax_JSON : syntax_SHELL;
+    fc.pathdelim = conf->delim;
+    fc.argdelim = argdelim;
+
+    if (emit) {
+        fc.syntax = emit;
+        fc.argdelim = ' ';
+        if (emit == syntax_CMAKE) {
+            fc.msvc = 0;  // CMake adapts flags to the toolchain itself
+        }
+    }
+
+    if (listing && emit) {
+        emitall(out, err, proc, &fc, filterc, filterl, *perm);
+        flush(out);
+        return;
+    } else if (listing) {
+        enterphase(perm, phase_OUTPUT);
         s8node *dirs = proc->search.list.head;
-        list(out, err, global, *perm, dirs, listing==list_ALL);
+        list(out, err, global, *perm, dirs, listing==list_ALL, conf->seed);
         flush(out);
         return;
     }
 
     pkgspec *specs = parsespecs(args, nargs, 0, err, perm);
-    pkgs pkgs = process(proc, specs, perm);
-
-    if (!pkgs.count) {
+    if (!specs) {
         prints8(err, S("pkg-config: "));
         prints8(err, S("requires at least one package name\n"));
         flush(err);
-        os_fail(err->ctx);
+        fail(err->ctx);
+    }
+
+    if (emit) {
+        // Resolve each package on its own, as separate runs would
+        pkgspec *ordered = 0;  // specs are parsed in reverse
+        while (specs) {
+            pkgspec *next = specs->next;
+            specs->next = ordered;
+            ordered = specs;
+            specs = next;
+        }
+        for (pkgspec *spec = ordered; spec; spec = spec->next) {
+            arena scratch = *perm;
+            pkgspec one = *spec;
+            one.next = 0;
+            enterphase(&scratch, phase_PROCESS);
+            pkgs pkgs = process(proc, &one, &scratch);
+            enterphase(&scratch, phase_OUTPUT);
+            writeemit(out, err, &fc, &pkgs, filterc, filterl, scratch);
+        }
+        flush(out);
+        return;
     }
 
+    pkgs pkgs = process(proc, specs, perm);
+    enterphase(perm, phase_OUTPUT);
+
     // --{atleast,exact,max}-version
     if (override_op) {
-        for (pkg *p = pkgs.head; p; p = p->list) {
-            i32 cmp = compareversions(p->version, override_version);
+        for (pkg *p = pkgs.recs; p < pkgs.recs+pkgs.count; p++) {
+            s8 version = getfield(p, field_VERSION);
+            i32 cmp = compareversions(version, override_version);
             if (!validcompare(override_op, cmp)) {
                 failversion(err, p, override_op, override_version);
             }
         }
     }
 
+    if (graphfmt == graph_DOT) {
+        writedot(out, &pkgs, proc->graph);
+        flush(out);
+        return;
+    } else if (graphfmt == graph_JSON) {
+        writegraphjson(out, &pkgs, proc->graph);
+        flush(out);
+        return;
+    }
+
+    if (json) {
+        writejson(
+            out, err, &fc, &pkgs, global, variable, filterc, filterl, *perm
+        );
+        flush(out);
+        return;
+    }
+
+    if (sections) {
+        writesections(out, err, &fc, &pkgs, *perm);
+        flush(out);
+        return;
+    }
+
     if (modversion) {
-        for (pkg *p = pkgs.head; p; p = p->list) {
+        for (pkg *p = pkgs.recs; p < pkgs.recs+pkgs.count; p++) {
             if (p->flags & pkg_DIRECT) {
-                prints8(out, p->version);
+                prints8(out, getfield(p, field_VERSION));
                 prints8(out, S("\n"));
             }
         }
     }
 
     if (variable.s) {
-        for (pkg *p = pkgs.head; p; p = p->list) {
+        for (pkg *p = pkgs.recs; p < pkgs.recs+pkgs.count; p++) {
             if (p->flags & pkg_DIRECT) {
                 s8 value = lookup(global, p->env, variable);
                 if (value.s) {
-                    expand(out, err, global, p, value);
+                    expand(out, err, global, p->env, p->path, value);
                     prints8(out, S("\n"));
                 }
             }
         }
     }
 
-    if (cflags) {
-        arena scratch = *perm;
-        fieldwriter fw = newfieldwriter(filterc, &argcount, &scratch);
-        fw.delim = argdelim;
-        fw.msvc = msvc;
-        if (!print_sysinc) {
-            insertsyspath(&fw, conf->sys_incpath, conf->delim, 'I');
-        }
-        for (pkg *p = pkgs.head; p; p = p->list) {
-            appendfield(err, &fw, p, p->cflags);
-            if (static_) {
-                appendfield(err, &fw, p, p->cflagsprivate);
+    if (print_variables) {
+        for (pkg *p = pkgs.recs; p < pkgs.recs+pkgs.count; p++) {
+            if (p->flags & pkg_DIRECT) {
+                for (i32 i = 0; i < p->env->len; i++) {
+                    prints8(out, p->env->vars[i].name);
+                    printu8(out, '\n');
+                }
             }
         }
-        writeargs(out, &fw);
     }
 
-    if (libs) {
-        arena scratch = *perm;
-        fieldwriter fw = newfieldwriter(filterl, &argcount, &scratch);
-        fw.delim = argdelim;
-        fw.msvc = msvc;
-        if (!print_syslib) {
-            insertsyspath(&fw, conf->sys_libpath, conf->delim, 'L');
-        }
-        for (pkg *p = pkgs.head; p; p = p->list) {
-            if (static_) {
-                appendfield(err, &fw, p, p->libs);
-                appendfield(err, &fw, p, p->libsprivate);
-            } else if (p->flags & pkg_PUBLIC) {
-                appendfield(err, &fw, p, p->libs);
+    if (variables.s) {
+        for (pkg *p = pkgs.recs; p < pkgs.recs+pkgs.count; p++) {
+            if (p->flags & pkg_DIRECT) {
+                printvariables(out, err, global, p, variables, *perm);
             }
         }
-        writeargs(out, &fw);
+    }
+
+    if (cflags) {
+        writecflags(out, err, &fc, &pkgs, filterc, &argcount, *perm);
+    }
+
+    if (libs) {
+        writelibs(out, err, &fc, &pkgs, filterl, &argcount, *perm);
     }
 
     if (cflags || libs) {
@@ -2197,3 +4560,143 @@ static void uconfig(config *conf)
 
     flush(out);
 }
+
+#ifdef UCONFIG_INSTRUMENT
+static void printstats(arena *perm)
+{
+    static const s8 names[] = {s8("parse"), s8("process"), s8("output")};
+    u8buf *err = newfdbuf(perm, 2, 1<<9);
+    struct {
+        s8  label;
+        i64 value;
+    } rows[] = {
+        {S("directories searched"), counters.dirs},
+        {S("opens attempted"),      counters.opens},
+        {S("opens failed"),         counters.openfails},
+        {S("files read"),           counters.files},
+        {S("bytes read"),           counters.bytes},
+        {S("packages loaded"),      counters.packages},
+        {S("variables expanded"),   counters.expansions},
+        {S("tokens deduplicated"),  counters.dedups},
+    };
+
+    prints8(err, S("pkg-config: stats\n"));
+    for (iz i = 0; i < countof(rows); i++) {
+        prints8(err, S("  "));
+        prints8(err, rows[i].label);
+        prints8(err, S(": "));
+        printi64(err, rows[i].value);
+        printu8(err, '\n');
+    }
+    for (i32 i = 0; i < phase_COUNT; i++) {
+        prints8(err, S("  "));
+        prints8(err, names[i]);
+        prints8(err, S(": "));
+        printi64(err, counters.time[i]);
+        prints8(err, S(" us, "));
+        printi64(err, counters.peak[i]);
+        prints8(err, S(" bytes arena peak\n"));
+    }
+    flush(err);
+}
+
+// Start tracing into a fixed buffer, flushed to the trace file as needed.
+static void starttrace(config *conf)
+{
+    arena *perm = &conf->perm;
+    iz cap = 1<<14;
+    iz scratch = 1<<12;
+    trace.scratch.beg = new(perm, byte, scratch);
+    trace.scratch.end = trace.scratch.beg + scratch;
+    trace.scratch.ctx = perm->ctx;
+    trace.path = conf->tracefile;
+    trace.pid = conf->pid;
+    trace.buf.buf = new(perm, u8, cap);
+    trace.buf.cap = cap;
+    trace.buf.ctx = perm->ctx;
+    prints8(&trace.buf, traceheader);
+}
+
+// Reserve the log record, and hash the environment variables that can
+// change a result so that only truly repeated queries are matched.
+static void startlog(config *conf)
+{
+    arena *perm = &conf->perm;
+    iz cap = 1<<12;
+    iz pkgcap = 1<<10;
+    iz scratch = 1<<12;
+    invocation.scratch.beg = new(perm, byte, scratch);
+    invocation.scratch.end = invocation.scratch.beg + scratch;
+    invocation.scratch.ctx = perm->ctx;
+    invocation.record.buf = new(perm, u8, cap);
+    invocation.record.cap = cap;
+    invocation.packages.buf = new(perm, u8, pkgcap);
+    invocation.packages.cap = pkgcap;
+    invocation.path = conf->logfile;
+    invocation.args = conf->args;
+    invocation.nargs = conf->nargs;
+    invocation.beg = os_now(perm->ctx);
+
+    s8 vars[] = {
+        conf->envpath, conf->fixedpath, conf->top_builddir,
+        conf->sys_incpath, conf->sys_libpath,
+        conf->print_sysinc, conf->print_syslib,
+    };
+    u32 h = 0;
+    for (iz i = 0; i < countof(vars); i++) {
+        h = s8hash(vars[i], h ^ (u32)!!vars[i].s);
+    }
+    invocation.envhash = h;
+}
+
+// Record the whole run as a span tagged with its command line.
+static void tracerun(config *conf, i64 beg)
+{
+    arena scratch = conf->perm;
+    u8buf mem = newmembuf(&scratch);
+    prints8(&mem, S("pkg-config"));
+    for (i32 i = 0; i < conf->nargs; i++) {
+        printu8(&mem, ' ');
+        prints8(&mem, s8fromcstr(conf->args[i]));
+    }
+    s8 command = finalize(&mem);
+    traceevent(scratch.ctx, S("pkg-config"), S("command"), command, beg);
+}
+#endif
+
+static void uconfig(config *conf)
+{
+    #ifdef UCONFIG_INSTRUMENT
+    counters = (stats){0};
+    counters.phase = phase_PROCESS;
+    trace = (tracer){0};
+    invocation = (runlog){0};
+    if (conf->logfile.s) {
+        startlog(conf);
+    }
+    if (conf->tracefile.s) {
+        starttrace(conf);
+    }
+    i64 beg = tracebegin(conf->perm.ctx);
+    #endif
+    #ifdef UCONFIG_MEMPROF
+    memprof = (memprofile){0};
+    #endif
+
+    execute(conf);
+
+    #ifdef UCONFIG_INSTRUMENT
+    if (counters.enabled) {
+        enterphase(&conf->perm, phase_OUTPUT);  // close the last span
+        printstats(&conf->perm);
+    }
+    if (trace.path.s) {
+        tracerun(conf, beg);
+        traceflush();
+    }
+    logrun(conf->perm.ctx, 0);
+    #endif
+    #ifdef UCONFIG_MEMPROF
+    memreport(conf->perm.ctx);
+    #endif
+}